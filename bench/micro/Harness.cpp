@@ -0,0 +1,155 @@
+#include "Harness.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+const char* pin_to_cpu(int cpu)
+{
+#ifdef _WIN32
+	if (cpu < 0 || cpu >= 64 || SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu) == 0)
+		return "Could not pin the thread to the CPU";
+	return nullptr;
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (cpu < 0 || cpu >= CPU_SETSIZE)
+		return "Could not pin the thread to the CPU";
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) != 0)
+		return "Could not pin the thread to the CPU";
+	return nullptr;
+#else
+	return "Pinning to a CPU is not supported on this platform";
+#endif
+}
+
+static bool matches(const std::string& name, const std::vector<std::string>& filters)
+{
+	if (filters.empty())
+		return true;
+	return std::any_of(filters.begin(), filters.end(), [&](const std::string& filter) { return name.find(filter) != std::string::npos; });
+}
+
+struct Repetition
+{
+	double elapsed_ns;
+	uint64_t units;
+};
+
+static Repetition repeat(const Benchmark& benchmark, uint64_t iterations)
+{
+	auto start = std::chrono::steady_clock::now();
+	uint64_t units = benchmark.run(iterations);
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return { double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()), units };
+}
+
+//The iterations which take at least the minimum time, the calibrating runs double as warmup
+static uint64_t calibrate(const Benchmark& benchmark, double min_time_ns)
+{
+	uint64_t iterations = 1;
+	while (true)
+	{
+		double elapsed_ns = repeat(benchmark, iterations).elapsed_ns;
+		if (elapsed_ns >= min_time_ns)
+			return iterations;
+
+		//Aim a bit above the minimum so the next run most likely reaches it, but never grow more than tenfold
+		double factor = elapsed_ns > 0 ? min_time_ns * 1.2 / elapsed_ns : 10;
+		iterations = uint64_t(std::ceil(iterations * std::clamp(factor, 2.0, 10.0)));
+	}
+}
+
+static double median(std::vector<double> values)
+{
+	std::sort(values.begin(), values.end());
+	size_t middle = values.size() / 2;
+	return values.size() % 2 ? values[middle] : (values[middle - 1] + values[middle]) / 2;
+}
+
+static Measurement measure(const Benchmark& benchmark, const BenchmarkOptions& options)
+{
+	uint64_t iterations = calibrate(benchmark, options.min_time_ms * 1e6);
+	repeat(benchmark, iterations);
+
+	std::vector<double> per_unit_ns;
+	double total_ns = 0;
+	for (size_t i = 0; i < options.repetitions; ++i)
+	{
+		Repetition repetition = repeat(benchmark, iterations);
+		per_unit_ns.push_back(repetition.elapsed_ns / std::max<uint64_t>(repetition.units, 1));
+		total_ns += repetition.elapsed_ns;
+	}
+
+	Measurement measurement;
+	measurement.name = benchmark.name;
+	measurement.unit = benchmark.unit;
+	measurement.iterations = iterations;
+	measurement.median_ns = median(per_unit_ns);
+	measurement.min_ns = *std::min_element(per_unit_ns.begin(), per_unit_ns.end());
+
+	//The median absolute deviation, unlike the standard deviation a few interrupted repetitions barely move it
+	std::vector<double> deviations;
+	for (double ns : per_unit_ns)
+		deviations.push_back(std::abs(ns - measurement.median_ns));
+	measurement.spread_percent = measurement.median_ns > 0 ? median(deviations) / measurement.median_ns * 100 : 0;
+
+	double total_bytes = double(benchmark.bytes_per_iteration) * iterations * options.repetitions;
+	measurement.mb_per_s = total_ns > 0 ? total_bytes / (1 << 20) / (total_ns / 1e9) : 0;
+	return measurement;
+}
+
+std::vector<Measurement> run_benchmarks(const std::vector<Benchmark>& benchmarks, const BenchmarkOptions& options, std::ostream& out)
+{
+	out << std::left << std::setw(36) << "benchmark" << std::right << std::setw(12) << "median" << std::setw(12) << "min"
+		<< std::setw(8) << "+-%" << std::setw(10) << "MB/s" << "  unit" << '\n';
+	out << std::fixed;
+
+	std::vector<Measurement> measurements;
+	for (const Benchmark& benchmark : benchmarks)
+	{
+		if (!matches(benchmark.name, options.filters))
+			continue;
+
+		const Measurement& measurement = measurements.emplace_back(measure(benchmark, options));
+		out << std::left << std::setw(36) << measurement.name << std::right << std::setprecision(2)
+			<< std::setw(12) << measurement.median_ns << std::setw(12) << measurement.min_ns
+			<< std::setprecision(1) << std::setw(8) << measurement.spread_percent << std::setw(10);
+		if (benchmark.bytes_per_iteration != 0)
+			out << measurement.mb_per_s;
+		else
+			out << "-";
+		out << "  ns/" << measurement.unit << std::endl;
+	}
+	out << std::defaultfloat;
+	return measurements;
+}
+
+void write_json(std::ostream& out, const std::vector<Measurement>& measurements, const BenchmarkOptions& options, int cpu)
+{
+	out << "{\"repetitions\": " << options.repetitions << ", \"min_time_ms\": " << options.min_time_ms << ", \"cpu\": ";
+	if (cpu >= 0)
+		out << cpu;
+	else
+		out << "null";
+
+	out << ", \"benchmarks\": [";
+	for (size_t i = 0; i < measurements.size(); ++i)
+	{
+		const Measurement& measurement = measurements[i];
+		out << (i ? ", " : "") << "{\"name\": \"" << measurement.name << "\", \"unit\": \"" << measurement.unit
+			<< "\", \"iterations\": " << measurement.iterations << ", \"median_ns\": " << measurement.median_ns
+			<< ", \"min_ns\": " << measurement.min_ns << ", \"spread_percent\": " << measurement.spread_percent
+			<< ", \"mb_per_s\": " << measurement.mb_per_s << "}";
+	}
+	out << "]}" << '\n';
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/*
+* A benchmark runs its operation "iterations" times and returns how many units of work (tokens, statements,
+* lookups...) that was, the harness reports the time per unit. Setup belongs outside of "run", in the code which
+* creates the benchmark.
+*/
+struct Benchmark
+{
+	std::string name;
+	const char* unit;
+	//Bytes of input handled by one iteration, 0 if a throughput in bytes means nothing for the benchmark
+	size_t bytes_per_iteration;
+	std::function<uint64_t(uint64_t iterations)> run;
+};
+
+struct BenchmarkOptions
+{
+	//Only benchmarks whose name contains one of these run, all of them if there are none
+	std::vector<std::string> filters;
+	//Measured repetitions of every benchmark, after calibrating and one repetition to warm up
+	size_t repetitions = 20;
+	//Minimum time of one repetition, the iterations are raised until it is reached
+	double min_time_ms = 10;
+};
+
+struct Measurement
+{
+	std::string name;
+	const char* unit;
+	uint64_t iterations;
+	//Per unit over the repetitions, the spread is the median absolute deviation relative to the median
+	double median_ns;
+	double min_ns;
+	double spread_percent;
+	double mb_per_s;
+};
+
+//Pins the calling thread to the CPU, returns the error or nullptr
+const char* pin_to_cpu(int cpu);
+
+//Keeps the compiler from dropping the computation of "value" as unused
+template <typename T>
+inline void keep(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	asm volatile("" : : "r,m"(value) : "memory");
+#else
+	static const void* volatile sink;
+	sink = &value;
+#endif
+}
+
+//Runs the benchmarks matching the filters one after the other, writing a line of text to "out" as each one finishes
+std::vector<Measurement> run_benchmarks(const std::vector<Benchmark>& benchmarks, const BenchmarkOptions& options, std::ostream& out);
+
+void write_json(std::ostream& out, const std::vector<Measurement>& measurements, const BenchmarkOptions& options, int cpu);
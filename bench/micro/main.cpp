@@ -0,0 +1,429 @@
+/*
+* Micro-benchmarks of the components of the interpreter, to tell which of them a change in the end-to-end times
+* (see bench/run.py) comes from. Built as its own executable from the sources here and those of /src without
+* main.cpp, see the README.
+*/
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "AST.h"
+#include "Context.h"
+#include "InputBuffer.h"
+#include "Interpreter.h"
+#include "Lexer.h"
+#include "OutputBuffer.h"
+#include "Parser.h"
+#include "Program.h"
+#include "ScopeManager.h"
+#include "ThreadPool.h"
+
+#include "Harness.h"
+
+//"piece" repeated until the text has at least "size" characters
+static std::shared_ptr<const std::string> repeat_text(const std::string& piece, size_t size)
+{
+	auto text = std::make_shared<std::string>();
+	while (text->size() < size)
+		*text += piece;
+	return text;
+}
+
+//Tokenizing a text made of one class of tokens
+static Benchmark lex_benchmark(const std::string& token_class, const std::string& piece)
+{
+	auto text = repeat_text(piece, 64 * 1024);
+	return { "lex/" + token_class, "token", text->size(), [text](uint64_t iterations)
+	{
+		uint64_t n_tokens = 0;
+		Lexer lexer;
+		for (uint64_t i = 0; i < iterations; ++i)
+		{
+			auto tokens = lexer.tokenize(*text);
+			if (tokens.is_error())
+			{
+				std::cerr << "Lexer error in benchmark: " << tokens.get_error().message << std::endl;
+				std::exit(1);
+			}
+			n_tokens += (*tokens).size();
+		}
+		return n_tokens;
+	} };
+}
+
+//Parsing (and freeing the tree of) a program made of one kind of statement, the tokens are made beforehand
+static Benchmark parse_benchmark(const std::string& construct, const std::string& statement, size_t n_statements = 256)
+{
+	auto text = std::make_shared<std::string>();
+	for (size_t i = 0; i < n_statements; ++i)
+		*text += statement + "\n";
+
+	auto tokens_res = Lexer().tokenize(*text);
+	if (tokens_res.is_error())
+	{
+		std::cerr << "Lexer error in benchmark " << construct << ": " << tokens_res.get_error().message << std::endl;
+		std::exit(1);
+	}
+	auto tokens = std::make_shared<std::vector<Token>>(std::move(*tokens_res));
+
+	return { "parse/" + construct, "stmt", text->size(), [text, tokens, n_statements](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; ++i)
+		{
+			Parser parser;
+			auto statements = parser.parse(*tokens);
+			if (statements.is_error())
+			{
+				std::cerr << "Syntax error in benchmark: " << statements.get_error().front().message << std::endl;
+				std::exit(1);
+			}
+			keep((*statements).size());
+		}
+		return iterations * n_statements;
+	} };
+}
+
+//An expression nested "depth" parentheses deep
+static std::string nested_expression(size_t depth)
+{
+	std::string expression = "a";
+	for (size_t i = 0; i < depth; ++i)
+		expression = "(" + expression + (i % 2 ? " * 2)" : " + 1)");
+	return expression;
+}
+
+/*
+* Looking up a variable with "depth" scopes pushed, each holding a few variables. The variable is either in the
+* innermost scope, in the global one so every scope is searched first, or not defined at all.
+*/
+static Benchmark scope_benchmark(size_t depth, const char* where)
+{
+	auto scopes = std::make_shared<ScopeManager>();
+	for (size_t i = 0; i < depth; ++i)
+	{
+		scopes->push_scope();
+		for (size_t j = 0; j < 8; ++j)
+			scopes->add_variable("local_" + std::to_string(i) + "_" + std::to_string(j), std::make_shared<NumberValue<int>>(int(j)));
+	}
+
+	std::string name = std::string(where) == "global" ? "local_0_3" : std::string(where) == "innermost" ? "local_" + std::to_string(depth - 1) + "_3" : "undefined";
+	return { "scope/depth_" + std::to_string(depth) + "/" + where, "lookup", 0, [scopes, name](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; ++i)
+			keep(scopes->get_variable(name));
+		return iterations;
+	} };
+}
+
+/*
+* The map of bench/map_lookup.txt with its phases timed on their own: inserting "size" int keys into an empty map,
+* which includes its growth and freeing it, and looking up keys of a map which holds "size" of them.
+*/
+static Benchmark map_insert_benchmark(int size)
+{
+	return { "map/size_" + std::to_string(size) + "/insert", "insert", 0, [size](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; ++i)
+		{
+			MapValue map;
+			for (int key = 0; key < size; ++key)
+				map.insert_or_assign({ MapKey::Kind::INT, key, {} }, std::make_shared<NumberValue<int>>(key * 2));
+			keep(map.entries.size());
+		}
+		return iterations * size;
+	} };
+}
+
+static Benchmark map_lookup_benchmark(int size, bool hit)
+{
+	auto map = std::make_shared<MapValue>();
+	for (int key = 0; key < size; ++key)
+		map->insert_or_assign({ MapKey::Kind::INT, key, {} }, std::make_shared<NumberValue<int>>(key * 2));
+
+	//The keys are visited out of order so a large map doesn't stay in the cache, missing keys are all above the others
+	return { "map/size_" + std::to_string(size) + (hit ? "/lookup_hit" : "/lookup_miss"), "lookup", 0, [map, size, hit](uint64_t iterations)
+	{
+		MapKey key{ MapKey::Kind::INT, 0, {} };
+		uint64_t index = 0;
+		for (uint64_t i = 0; i < iterations; ++i)
+		{
+			index = (index + 7919) % size;
+			key.number = static_cast<int>(index) + (hit ? 0 : size);
+			keep(map->entries.find(key));
+		}
+		return iterations;
+	} };
+}
+
+/*
+* Evaluating a node whose operands are literals, which reaches the private value visitors of the interpreter
+* (BinaryOperationVisitor, CastVisitor) the way scripts do. "value/literal" is the cost of evaluating an operand
+* alone, to compare the others with.
+*/
+struct Evaluator
+{
+	std::string output_text;
+	OutputBuffer output{ output_text };
+	InputBuffer input{ true };
+	Interpreter interpreter{ output, input };
+};
+
+static Benchmark eval_benchmark(const std::string& name, ASTNode* node)
+{
+	auto evaluator = std::make_shared<Evaluator>();
+	std::shared_ptr<ASTNode> tree(node);
+
+	InterpreterResult res = tree->accept(evaluator->interpreter);
+	bool expect_error = name.find("invalid") != std::string::npos;
+	if (res.is_error() != expect_error)
+	{
+		std::cerr << "Unexpected result in benchmark " << name << std::endl;
+		std::exit(1);
+	}
+
+	return { name, "op", 0, [evaluator, tree](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; ++i)
+		{
+			InterpreterResult res = tree->accept(evaluator->interpreter);
+			keep(res.is_error());
+		}
+		return iterations;
+	} };
+}
+
+static ASTNode* binary(Operator op, ASTNode* lhs, ASTNode* rhs)
+{
+	return new ASTBinaryNode(op, lhs, rhs);
+}
+
+static ASTNode* literal(const char* text)
+{
+	return new ASTLiteralNode(std::string(text));
+}
+
+/*
+* Calls between the host and scripts through a Context (see Embedding in the README). The host calls a script function
+* which returns a value and one which doesn't, scripts call a script function and a native one in a loop. The loops
+* include their own iterations, "host/loop_iteration" is the cost of one to subtract.
+*/
+static const char* host_script =
+	"fn add(a, b) { ret a + b; };\n"
+	"fn noop(a) { };\n"
+	"fn empty_loop(n) { let i := 0; while (i < n) { i := i + 1; }; };\n"
+	"fn script_loop(n) { let i := 0; while (i < n) { add(i, 1); i := i + 1; }; };\n"
+	"fn native_loop(n) { let i := 0; while (i < n) { host_add(i, 1); i := i + 1; }; };\n";
+
+struct Host
+{
+	ThreadPool pool{ 1 };
+	std::string output_text;
+	OutputBuffer output{ output_text };
+	InputBuffer input{ true };
+	std::unique_ptr<Context> context;
+};
+
+static std::shared_ptr<Host> create_host()
+{
+	auto host = std::make_shared<Host>();
+	auto text = std::make_shared<std::string>(host_script);
+	auto program = Program::parse(text, *text, "", {}, host->pool);
+	if (program.is_error())
+	{
+		std::cerr << "Syntax error in host benchmark: " << program.get_error().front().message << std::endl;
+		std::exit(1);
+	}
+
+	host->context = std::make_unique<Context>(*program, host->output, host->input, host->pool);
+	host->context->register_function("host_add", 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		auto* a = dynamic_cast<const NumberValue<int>*>(args[0].get());
+		auto* b = dynamic_cast<const NumberValue<int>*>(args[1].get());
+		if (!a || !b)
+			return "Expected int and int";
+		return { std::make_shared<NumberValue<int>>(a->value + b->value) };
+	});
+	if (!host->context->run())
+	{
+		std::cerr << "Error in host benchmark: " << host->output_text << std::endl;
+		std::exit(1);
+	}
+	return host;
+}
+
+static Interpreter::Function host_function(const Host& host, const char* name)
+{
+	std::optional<Interpreter::Function> function = host.context->find_function(name);
+	if (!function)
+	{
+		std::cerr << "Host benchmark function " << name << " does not exist" << std::endl;
+		std::exit(1);
+	}
+	return *function;
+}
+
+//The host calls "function" once per iteration
+template <typename... Args>
+static Benchmark host_call_benchmark(const std::string& name, std::shared_ptr<Host> host, const char* function, Args... args)
+{
+	Interpreter::Function func = host_function(*host, function);
+	if (host->context->call(func, args...).is_error())
+	{
+		std::cerr << "Error in benchmark " << name << std::endl;
+		std::exit(1);
+	}
+
+	return { name, "call", 0, [host, func, args...](uint64_t iterations)
+	{
+		for (uint64_t i = 0; i < iterations; ++i)
+			keep(host->context->call(func, args...).is_error());
+		return iterations;
+	} };
+}
+
+//The script loops "iterations" times in one call from the host
+static Benchmark script_loop_benchmark(const std::string& name, std::shared_ptr<Host> host, const char* function)
+{
+	Interpreter::Function func = host_function(*host, function);
+	if (host->context->call(func, 1).is_error())
+	{
+		std::cerr << "Error in benchmark " << name << std::endl;
+		std::exit(1);
+	}
+
+	return { name, "iteration", 0, [host, func](uint64_t iterations)
+	{
+		keep(host->context->call(func, static_cast<int>(iterations)).is_error());
+		return iterations;
+	} };
+}
+
+static std::vector<Benchmark> create_benchmarks()
+{
+	std::vector<Benchmark> benchmarks;
+
+	benchmarks.push_back(lex_benchmark("identifier", "counter alpha_12 value_name x "));
+	benchmarks.push_back(lex_benchmark("keyword", "while let print ret "));
+	benchmarks.push_back(lex_benchmark("type", "int float char string "));
+	benchmarks.push_back(lex_benchmark("integer", "7 42 123456 0 "));
+	benchmarks.push_back(lex_benchmark("float", "3.14159 0.5 .25 "));
+	benchmarks.push_back(lex_benchmark("char", "'a' 'z' "));
+	benchmarks.push_back(lex_benchmark("string", "\"hello world\" \"a longer string literal\" "));
+	benchmarks.push_back(lex_benchmark("operator", ":= && || >= <= == + - * / < > "));
+	benchmarks.push_back(lex_benchmark("special", "(){}[];,."));
+	benchmarks.push_back(lex_benchmark("comment", "x //a line comment which the lexer skips\n/* and a block comment */ "));
+
+	benchmarks.push_back(parse_benchmark("let", "let x := 1;"));
+	benchmarks.push_back(parse_benchmark("assignment", "x := x + 1;"));
+	benchmarks.push_back(parse_benchmark("call", "f(a, 1, \"text\");"));
+	benchmarks.push_back(parse_benchmark("field", "p.x := p.y.z;"));
+	benchmarks.push_back(parse_benchmark("if_else", "if (a < b) { x := 1; } else { x := 2; };"));
+	benchmarks.push_back(parse_benchmark("while", "while (i < 10) { i := i + 1; };"));
+	benchmarks.push_back(parse_benchmark("function", "fn f(a, b) { let c := a + b; ret c; };"));
+	benchmarks.push_back(parse_benchmark("struct", "struct Point { x, y, z };"));
+	for (size_t depth : { 1, 8, 32, 128 })
+		benchmarks.push_back(parse_benchmark("expr_depth_" + std::to_string(depth), "let x := " + nested_expression(depth) + ";", 64));
+
+	for (int size : { 1000, 1000000 })
+	{
+		benchmarks.push_back(map_insert_benchmark(size));
+		benchmarks.push_back(map_lookup_benchmark(size, true));
+		benchmarks.push_back(map_lookup_benchmark(size, false));
+	}
+
+	for (size_t depth : { 1, 4, 16, 64 })
+	{
+		benchmarks.push_back(scope_benchmark(depth, "innermost"));
+		benchmarks.push_back(scope_benchmark(depth, "global"));
+		benchmarks.push_back(scope_benchmark(depth, "undefined"));
+	}
+
+	benchmarks.push_back(eval_benchmark("value/literal", new ASTLiteralNode(1)));
+	benchmarks.push_back(eval_benchmark("binary/int+int", binary(Operator::PLUS, new ASTLiteralNode(1), new ASTLiteralNode(2))));
+	benchmarks.push_back(eval_benchmark("binary/int*int", binary(Operator::TIMES, new ASTLiteralNode(3), new ASTLiteralNode(4))));
+	benchmarks.push_back(eval_benchmark("binary/int<int", binary(Operator::LESS_THAN, new ASTLiteralNode(1), new ASTLiteralNode(2))));
+	benchmarks.push_back(eval_benchmark("binary/float+float", binary(Operator::PLUS, new ASTLiteralNode(1.5f), new ASTLiteralNode(2.5f))));
+	benchmarks.push_back(eval_benchmark("binary/float<float", binary(Operator::LESS_THAN, new ASTLiteralNode(1.5f), new ASTLiteralNode(2.5f))));
+	benchmarks.push_back(eval_benchmark("binary/int+float", binary(Operator::PLUS, new ASTLiteralNode(1), new ASTLiteralNode(2.5f))));
+	benchmarks.push_back(eval_benchmark("binary/float+int", binary(Operator::PLUS, new ASTLiteralNode(1.5f), new ASTLiteralNode(2))));
+	benchmarks.push_back(eval_benchmark("binary/char+int", binary(Operator::PLUS, new ASTLiteralNode('a'), new ASTLiteralNode(1))));
+	benchmarks.push_back(eval_benchmark("binary/string+string", binary(Operator::PLUS, literal("hello "), literal("world"))));
+	benchmarks.push_back(eval_benchmark("binary/string==string", binary(Operator::EQUALS, literal("hello world"), literal("hello world"))));
+
+	benchmarks.push_back(eval_benchmark("cast/str_to_int", new ASTCastNode(Type::INT, literal("123456"))));
+	benchmarks.push_back(eval_benchmark("cast/str_to_float", new ASTCastNode(Type::FLOAT, literal("3.14159"))));
+	benchmarks.push_back(eval_benchmark("cast/str_to_int_invalid", new ASTCastNode(Type::INT, literal("not a number"))));
+
+	std::shared_ptr<Host> host = create_host();
+	benchmarks.push_back(host_call_benchmark("host/call_add", host, "add", 2, 3));
+	benchmarks.push_back(host_call_benchmark("host/call_empty", host, "noop", 1));
+	benchmarks.push_back(script_loop_benchmark("host/loop_iteration", host, "empty_loop"));
+	benchmarks.push_back(script_loop_benchmark("host/script_to_script", host, "script_loop"));
+	benchmarks.push_back(script_loop_benchmark("host/script_to_native", host, "native_loop"));
+
+	return benchmarks;
+}
+
+int main(int argc, char* argv[])
+{
+	BenchmarkOptions options;
+	int cpu = -1;
+	std::string json_path;
+	bool list = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--filter" && i + 1 < argc)
+			options.filters.push_back(argv[++i]);
+		else if (arg == "--repetitions" && i + 1 < argc)
+			options.repetitions = std::max<size_t>(1, std::strtoul(argv[++i], nullptr, 10));
+		else if (arg == "--min-time" && i + 1 < argc)
+			options.min_time_ms = std::strtod(argv[++i], nullptr);
+		else if (arg == "--cpu" && i + 1 < argc)
+			cpu = std::atoi(argv[++i]);
+		else if (arg == "--json" && i + 1 < argc)
+			json_path = argv[++i];
+		else if (arg == "--list")
+			list = true;
+		else
+		{
+			std::cerr << "Usage: " << argv[0] << " [--filter <text>]... [--repetitions <n>] [--min-time <ms>] [--cpu <n>] [--json <file>] [--list]" << std::endl;
+			return 1;
+		}
+	}
+
+	if (cpu >= 0)
+	{
+		if (const char* error = pin_to_cpu(cpu))
+		{
+			std::cerr << error << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<Benchmark> benchmarks = create_benchmarks();
+	if (list)
+	{
+		for (const Benchmark& benchmark : benchmarks)
+			std::cout << benchmark.name << '\n';
+		return 0;
+	}
+
+	std::vector<Measurement> measurements = run_benchmarks(benchmarks, options, std::cout);
+	if (!json_path.empty())
+	{
+		std::ofstream json(json_path);
+		write_json(json, measurements, options, cpu);
+		if (!json)
+		{
+			std::cerr << "Could not write " << json_path << std::endl;
+			return 1;
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,210 @@
+#!/usr/bin/env python3
+"""
+Runs the benchmark scripts in this directory and reports their times, peak memory and allocation counts as JSON.
+
+	python3 bench/run.py --interpreter ./Interpreter [--runs 5] [--output results.json]
+	python3 bench/run.py --interpreter ./Interpreter --save-baseline baseline.json
+	python3 bench/run.py --interpreter ./Interpreter --baseline baseline.json [--threshold 10]
+
+Every benchmark runs once to warm up and then --runs times. The wall time of each run is measured around the process,
+the peak resident memory is the one the kernel reports for it. Allocation counts need a build with INTERPRETER_STATS
+defined (see --stats), they are taken from one extra run of --counts-interpreter, or of --interpreter if it was built
+with the counters.
+
+With --baseline the results are compared to a saved run and the exit code is 1 if the median time, the peak memory
+or the number of allocations of any benchmark grew by more than its threshold. A benchmark which fails to run exits
+with 2.
+"""
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+
+
+def generate_large_source(path, n_functions=8000):
+	"""A large file of declarations and statements, parsing it stresses the lexer and the parser."""
+	with open(path, "w") as out:
+		out.write("//Generated by bench/run.py\n")
+		out.write("struct Pair { first, second };\n")
+		for i in range(n_functions):
+			out.write(
+				f"fn f{i}(a, b, c)\n{{\n"
+				f"\tlet x := (a + {i}) * (b - c) / 3;\n"
+				f"\tlet s := \"value \" + (string)x;\n"
+				f"\tif (x > {i % 97} && b <= c) {{ x := x - 1; }} else {{ x := x + 1; }};\n"
+				f"\twhile (x > 0) {{ x := x - {i % 7 + 1}; }};\n"
+				f"\tlet p := Pair(x, s);\n"
+				f"\tret p.first + (int)2.5;\n"
+				f"}};\n"
+			)
+			out.write(f"let v{i} := f{i}({i}, {i % 13}, {i % 5});\n")
+
+
+# The scripts are relative to bench/, "generate" creates the script in a temporary directory first
+BENCHMARKS = [
+	{"name": "fib", "script": "fib.txt"},
+	{"name": "nested_loops", "script": "nested_loops.txt"},
+	{"name": "string_build", "script": "string_build.txt"},
+	{"name": "casts", "script": "casts.txt"},
+	{"name": "deep_recursion", "script": "deep_recursion.txt"},
+	{"name": "parse_large", "script": "parse_large.txt", "generate": generate_large_source, "args": ["--validate"]},
+	{"name": "gc_cycles", "script": "gc_cycles.txt"},
+	{"name": "print_int", "script": "print_int.txt"},
+	{"name": "map_lookup", "script": "map_lookup.txt"},
+	{"name": "generator_pipeline", "script": "generator_pipeline.txt"},
+]
+
+
+def run_once(interpreter, args, script):
+	"""Runs the script once, returns the wall time in ms and the peak RSS in KB or None if it failed."""
+	start = time.perf_counter()
+	process = subprocess.Popen([interpreter] + args + [script], stdin=subprocess.DEVNULL, stdout=subprocess.DEVNULL,
+		stderr=subprocess.PIPE)
+	_, status, usage = os.wait4(process.pid, 0)
+	elapsed_ms = (time.perf_counter() - start) * 1000
+	stderr = process.stderr.read().decode(errors="replace")
+	process.stderr.close()
+	if os.waitstatus_to_exitcode(status) != 0:
+		sys.stderr.write(stderr)
+		return None
+	# ru_maxrss is in KB on Linux and in bytes on macOS
+	rss_kb = usage.ru_maxrss // 1024 if sys.platform == "darwin" else usage.ru_maxrss
+	return elapsed_ms, rss_kb
+
+
+def read_counts(interpreter, args, script, directory):
+	"""The counters of one run from --stats-json, None if the interpreter was built without them."""
+	stats_path = os.path.join(directory, "stats.json")
+	result = subprocess.run([interpreter] + args + ["--stats-json", stats_path, script], stdin=subprocess.DEVNULL,
+		stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+	if result.returncode != 0 or not os.path.exists(stats_path):
+		return None
+	with open(stats_path) as file:
+		stats = json.load(file)
+	os.remove(stats_path)
+	if not stats.get("enabled"):
+		return None
+	return {"allocations": stats["allocations"], "total_allocations": sum(stats["allocations"].values()),
+		"calls": stats["calls"]}
+
+
+def percentile(values, fraction):
+	"""Nearest rank percentile, with few runs p95 is the slowest run."""
+	ordered = sorted(values)
+	rank = max(0, min(len(ordered) - 1, int(round(fraction * len(ordered) + 0.5)) - 1))
+	return ordered[rank]
+
+
+def run_benchmarks(options, directory):
+	results = {}
+	for benchmark in BENCHMARKS:
+		if options.filter and not any(name in benchmark["name"] for name in options.filter):
+			continue
+
+		if "generate" in benchmark:
+			script = os.path.join(directory, benchmark["script"])
+			benchmark["generate"](script)
+		else:
+			script = os.path.join(BENCH_DIR, benchmark["script"])
+		args = options.args + benchmark.get("args", [])
+
+		times = []
+		rss = []
+		for i in range(options.warmup + options.runs):
+			measurement = run_once(options.interpreter, args, script)
+			if measurement is None:
+				print(f"{benchmark['name']}: failed", file=sys.stderr)
+				sys.exit(2)
+			if i >= options.warmup:
+				times.append(measurement[0])
+				rss.append(measurement[1])
+
+		result = {
+			"median_ms": round(statistics.median(times), 3),
+			"p95_ms": round(percentile(times, 0.95), 3),
+			"min_ms": round(min(times), 3),
+			"max_rss_kb": max(rss),
+			"runs": len(times),
+		}
+		counts_interpreter = options.counts_interpreter or options.interpreter
+		counts = read_counts(counts_interpreter, args, script, directory)
+		if counts:
+			result.update(counts)
+		results[benchmark["name"]] = result
+
+		summary = f"{benchmark['name']:<20} median {result['median_ms']:9.1f} ms  p95 {result['p95_ms']:9.1f} ms  rss {result['max_rss_kb'] / 1024:7.1f} MB"
+		if counts:
+			summary += f"  allocations {counts['total_allocations']}"
+		print(summary, file=sys.stderr)
+	return results
+
+
+def compare(results, baseline, options):
+	"""Prints the change of every benchmark, returns the regressions."""
+	regressions = []
+	checks = [("median_ms", options.threshold), ("max_rss_kb", options.rss_threshold),
+		("total_allocations", options.allocation_threshold)]
+	for name, result in results.items():
+		base = baseline.get(name)
+		if base is None:
+			continue
+		for key, threshold in checks:
+			if key not in result or key not in base or base[key] == 0:
+				continue
+			change = (result[key] - base[key]) / base[key] * 100
+			regressed = change > threshold
+			print(f"{name:<20} {key:<18} {base[key]:>12} -> {result[key]:>12} {change:+7.1f}%{'  REGRESSION' if regressed else ''}",
+				file=sys.stderr)
+			if regressed:
+				regressions.append(f"{name} {key} {change:+.1f}%")
+	return regressions
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Runs the benchmark scripts and compares them to a baseline")
+	parser.add_argument("--interpreter", required=True, help="the interpreter to measure")
+	parser.add_argument("--runs", type=int, default=5, help="measured runs of every benchmark (default 5)")
+	parser.add_argument("--warmup", type=int, default=1, help="runs before measuring (default 1)")
+	parser.add_argument("--filter", action="append", help="only run benchmarks whose name contains this, repeatable")
+	parser.add_argument("--arg", dest="args", action="append", default=[], help="extra interpreter option, repeatable")
+	parser.add_argument("--counts-interpreter", help="build with INTERPRETER_STATS used to count the allocations")
+	parser.add_argument("--output", help="write the results to this file instead of stdout")
+	parser.add_argument("--save-baseline", help="write the results to this file to compare later runs against")
+	parser.add_argument("--baseline", help="compare to the results saved in this file")
+	parser.add_argument("--threshold", type=float, default=10, help="allowed growth of the median time in %% (default 10)")
+	parser.add_argument("--rss-threshold", type=float, default=10, help="allowed growth of the peak memory in %% (default 10)")
+	parser.add_argument("--allocation-threshold", type=float, default=1, help="allowed growth of the allocations in %% (default 1)")
+	options = parser.parse_args()
+
+	with tempfile.TemporaryDirectory() as directory:
+		results = run_benchmarks(options, directory)
+
+	report = {"interpreter": options.interpreter, "benchmarks": results}
+	text = json.dumps(report, indent=2)
+	if options.output:
+		with open(options.output, "w") as file:
+			file.write(text + "\n")
+	else:
+		print(text)
+	if options.save_baseline:
+		with open(options.save_baseline, "w") as file:
+			file.write(text + "\n")
+
+	if options.baseline:
+		with open(options.baseline) as file:
+			baseline = json.load(file)["benchmarks"]
+		regressions = compare(results, baseline, options)
+		if regressions:
+			print("regressions: " + ", ".join(regressions), file=sys.stderr)
+			sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()
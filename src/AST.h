@@ -5,8 +5,16 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <stdexcept>
+#include <string_view>
 
 #include "ASTVisitor.h"
+#include "Error.h"
+#include "Result.h"
 #include "Value.h"
 
 enum class Operator
@@ -24,20 +32,22 @@ enum class Operator
 	OR
 };
 
-static const std::unordered_map<std::string, Operator> op_str_to_enum
+//The tables are functions rather than static maps so the tree has no global state to construct or share
+inline Operator operator_from_string(std::string_view op)
 {
-	{"+", Operator::PLUS},
-	{"-", Operator::MINUS},
-	{"*", Operator::TIMES},
-	{"/", Operator::DIVIDED},
-	{">", Operator::GREATER_THAN},
-	{"<", Operator::LESS_THAN},
-	{"==", Operator::EQUALS},
-	{">=", Operator::GEQ},
-	{"<=", Operator::LEQ},
-	{"&&", Operator::AND},
-	{"||", Operator::OR}
-};
+	if (op == "+") return Operator::PLUS;
+	if (op == "-") return Operator::MINUS;
+	if (op == "*") return Operator::TIMES;
+	if (op == "/") return Operator::DIVIDED;
+	if (op == ">") return Operator::GREATER_THAN;
+	if (op == "<") return Operator::LESS_THAN;
+	if (op == "==") return Operator::EQUALS;
+	if (op == ">=") return Operator::GEQ;
+	if (op == "<=") return Operator::LEQ;
+	if (op == "&&") return Operator::AND;
+	if (op == "||") return Operator::OR;
+	throw std::out_of_range("Unknown operator");
+}
 
 enum class Type
 {
@@ -47,19 +57,21 @@ enum class Type
 	STRING
 };
 
-static const std::unordered_map<std::string, Type> type_str_to_enum
+inline Type type_from_string(std::string_view type)
 {
-	{"int", Type::INT},
-	{"char", Type::CHAR},
-	{"float", Type::FLOAT},
-	{"string", Type::STRING}
-};
+	if (type == "int") return Type::INT;
+	if (type == "char") return Type::CHAR;
+	if (type == "float") return Type::FLOAT;
+	if (type == "string") return Type::STRING;
+	throw std::out_of_range("Unknown type");
+}
 
 using InterpreterResult = Result<std::shared_ptr<Value>, const char*>;
 
 class ASTNode
 {
 public:
+	virtual ~ASTNode() = default;
 	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const = 0;
 };
 
@@ -77,6 +89,15 @@ public:
 		m_value = std::make_shared<StringValue>(value);
 	}
 
+	//References "value" inside the source kept alive by "owner", the contents are copied if there is no owner
+	ASTLiteralNode(std::string_view value, std::shared_ptr<const void> owner)
+	{
+		if (owner)
+			m_value = std::make_shared<StringValue>(value, std::move(owner));
+		else
+			m_value = std::make_shared<StringValue>(std::string(value));
+	}
+
 	inline const std::shared_ptr<Value>& get_value() const { return m_value; }
 	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const 
 	{ 
@@ -86,7 +107,7 @@ private:
 	std::shared_ptr<Value> m_value; 
 };  
 
-class ASTIdentifierNode : public ASTNode
+class ASTIdentifierNode final : public ASTNode
 {
 public:
 	ASTIdentifierNode(const std::string& name)
@@ -108,7 +129,12 @@ class ASTUnaryNode : public ASTNode
 {
 public:
 	ASTUnaryNode(const std::string& op, ASTNode* operand)
-		: m_operator(op_str_to_enum.at(op))
+		: m_operator(operator_from_string(op))
+		, m_operand(operand)
+	{}
+
+	ASTUnaryNode(Operator op, ASTNode* operand)
+		: m_operator(op)
 		, m_operand(operand)
 	{}
 
@@ -129,7 +155,13 @@ class ASTBinaryNode : public ASTNode
 {
 public:
 	ASTBinaryNode(const std::string& op, ASTNode* lhs, ASTNode* rhs)
-		: m_operator(op_str_to_enum.at(op))
+		: m_operator(operator_from_string(op))
+		, m_lhs(lhs)
+		, m_rhs(rhs)
+	{}
+
+	ASTBinaryNode(Operator op, ASTNode* lhs, ASTNode* rhs)
+		: m_operator(op)
 		, m_lhs(lhs)
 		, m_rhs(rhs)
 	{}
@@ -173,15 +205,52 @@ private:
 class ASTFunctionNode : public ASTNode
 {
 public:
-	ASTFunctionNode(const std::string& fn_name, const std::vector<std::string>& args, ASTBlockNode* block)
+	//Parses the body of a lazily parsed function, the result is owned by the caller
+	using BodyParser = std::function<Result<ASTBlockNode*, Error>()>;
+
+	ASTFunctionNode(const std::string& fn_name, const std::vector<std::string>& args, ASTBlockNode* block, bool is_generator = false)
 		: m_fn_name(fn_name)
 		, m_args(args)
 		, m_block(block)
+		, m_is_generator(is_generator)
+	{}
+
+	//The body is only parsed when it's needed the first time, see get_body()
+	ASTFunctionNode(const std::string& fn_name, const std::vector<std::string>& args, BodyParser parse_body, bool is_generator)
+		: m_fn_name(fn_name)
+		, m_args(args)
+		, m_parse_body(std::move(parse_body))
+		, m_is_generator(is_generator)
 	{}
 
 	inline const std::string& get_name() const { return m_fn_name; }
 	inline const std::vector<std::string>& get_args() const { return m_args; }
-	inline const std::unique_ptr<ASTBlockNode>& get_block() const { return m_block; }
+
+	/*
+	* Returns the body, parsing it first if it was skipped by the parser. Returns the syntax error
+	* if the body can't be parsed, every call returns the same error.
+	*/
+	Result<const ASTBlockNode*, const char*> get_body() const
+	{
+		if (m_parse_body)
+		{
+			std::call_once(m_parse_once, [this]()
+			{
+				Result<ASTBlockNode*, Error> res = m_parse_body();
+				if (res.is_error())
+					m_error = std::string(res.get_error().message) + " at: " + std::to_string(res.get_error().position) + " in function " + m_fn_name;
+				else
+					m_block.reset(*res);
+			});
+		}
+
+		if (!m_block)
+			return m_error.c_str();
+		return static_cast<const ASTBlockNode*>(m_block.get());
+	}
+
+	//Functions containing "yield" return a generator when called instead of running their body
+	inline bool is_generator() const { return m_is_generator; }
 
 	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
 	{
@@ -191,7 +260,11 @@ public:
 private:
 	const std::string m_fn_name;
 	const std::vector<std::string> m_args;
-	const std::unique_ptr<ASTBlockNode> m_block;
+	mutable std::unique_ptr<ASTBlockNode> m_block;
+	const BodyParser m_parse_body;
+	mutable std::once_flag m_parse_once;
+	mutable std::string m_error;
+	const bool m_is_generator;
 };
 
 class ASTCallNode : public ASTNode
@@ -281,13 +354,16 @@ private:
 class ASTWhileNode : public ASTNode
 {
 public:
-	ASTWhileNode(ASTNode* condition, ASTNode* then_stmt)
+	//"position" is the position of the "while" in its source
+	ASTWhileNode(ASTNode* condition, ASTNode* then_stmt, size_t position = 0)
 		: m_condition(condition)
 		, m_then_stmt(then_stmt)
+		, m_position(position)
 	{}
 
 	inline const std::unique_ptr<ASTNode>& get_conditon() const { return m_condition; }
 	inline const std::unique_ptr<ASTNode>& get_then_stmt() const { return m_then_stmt; }
+	inline size_t get_position() const { return m_position; }
 
 	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
 	{
@@ -297,6 +373,7 @@ public:
 private:
 	const std::unique_ptr<ASTNode> m_condition;
 	const std::unique_ptr<ASTNode> m_then_stmt;
+	const size_t m_position;
 };
 
 class ASTPrintNode : public ASTNode
@@ -321,7 +398,12 @@ class ASTCastNode : public ASTNode
 {
 public:
 	ASTCastNode(const std::string& type, ASTNode* expr)
-		: m_type(type_str_to_enum.at(type))
+		: m_type(type_from_string(type))
+		, m_expr(expr)
+	{}
+
+	ASTCastNode(Type type, ASTNode* expr)
+		: m_type(type)
 		, m_expr(expr)
 	{}
 
@@ -367,4 +449,183 @@ public:
 private:
 	const std::string m_var_name;
 	const std::vector<std::unique_ptr<ASTNode>> m_stmts;
+};
+
+class ASTStructNode : public ASTNode
+{
+public:
+	ASTStructNode(const std::string& name, const std::vector<std::string>& fields)
+		: m_layout(std::make_shared<StructLayout>(name, fields))
+	{}
+
+	inline const std::shared_ptr<const StructLayout>& get_layout() const { return m_layout; }
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	const std::shared_ptr<const StructLayout> m_layout;
+};
+
+class ASTFieldNode : public ASTNode
+{
+public:
+	ASTFieldNode(ASTNode* object, const std::string& field)
+		: m_object(object)
+		, m_field(field)
+	{}
+
+	inline const std::unique_ptr<ASTNode>& get_object() const { return m_object; }
+	inline const std::string& get_field() const { return m_field; }
+
+	/*
+	* Resolves the field to a slot index in the given layout.
+	* Each access site remembers the last layout it saw so repeated accesses
+	* on records of the same struct become a plain indexed load.
+	* The AST is shared between threads so the cache entries are immutable and
+	* only the pointer to the current entry is swapped.
+	*/
+	inline size_t resolve_slot(const StructLayout* layout) const
+	{
+		const SlotCache* cache = m_cache.load(std::memory_order_acquire);
+		if (cache && cache->layout == layout)
+			return cache->slot;
+		return resolve_slot_slow(layout);
+	}
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	struct SlotCache
+	{
+		const StructLayout* layout;
+		size_t slot;
+	};
+
+	size_t resolve_slot_slow(const StructLayout* layout) const
+	{
+		std::lock_guard<std::mutex> lock(m_cache_mutex);
+
+		const SlotCache* cache = nullptr;
+		for (const auto& entry : m_cache_entries)
+		{
+			if (entry->layout == layout)
+				cache = entry.get();
+		}
+
+		if (!cache)
+		{
+			m_cache_entries.push_back(std::make_unique<SlotCache>(SlotCache{ layout, layout->index_of(m_field) }));
+			cache = m_cache_entries.back().get();
+		}
+
+		m_cache.store(cache, std::memory_order_release);
+		return cache->slot;
+	}
+
+	const std::unique_ptr<ASTNode> m_object;
+	const std::string m_field;
+
+	mutable std::atomic<const SlotCache*> m_cache{ nullptr };
+	mutable std::mutex m_cache_mutex;
+	mutable std::vector<std::unique_ptr<SlotCache>> m_cache_entries;
+};
+
+class ASTFieldAssignmentNode : public ASTNode
+{
+public:
+	ASTFieldAssignmentNode(ASTFieldNode* field, ASTNode* expr)
+		: m_field(field)
+		, m_expr(expr)
+	{}
+
+	inline const std::unique_ptr<ASTFieldNode>& get_field() const { return m_field; }
+	inline const std::unique_ptr<ASTNode>& get_expr() const { return m_expr; }
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	const std::unique_ptr<ASTFieldNode> m_field;
+	const std::unique_ptr<ASTNode> m_expr;
+};
+
+class ASTSpawnNode : public ASTNode
+{
+public:
+	ASTSpawnNode(ASTCallNode* call)
+		: m_call(call)
+	{}
+
+	inline const std::unique_ptr<ASTCallNode>& get_call() const { return m_call; }
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	const std::unique_ptr<ASTCallNode> m_call;
+};
+
+class ASTAwaitNode : public ASTNode
+{
+public:
+	ASTAwaitNode(ASTNode* expr)
+		: m_expr(expr)
+	{}
+
+	inline const std::unique_ptr<ASTNode>& get_expr() const { return m_expr; }
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	const std::unique_ptr<ASTNode> m_expr;
+};
+
+class ASTYieldNode : public ASTNode
+{
+public:
+	ASTYieldNode(ASTNode* expr)
+		: m_expr(expr)
+	{}
+
+	inline const std::unique_ptr<ASTNode>& get_expr() const { return m_expr; }
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	const std::unique_ptr<ASTNode> m_expr;
+};
+
+//Loads the module at "path" and defines its functions and structs under the module's namespace, see ModuleLoader
+class ASTImportNode : public ASTNode
+{
+public:
+	ASTImportNode(const std::string& path)
+		: m_path(path)
+	{}
+
+	inline const std::string& get_path() const { return m_path; }
+
+	inline virtual InterpreterResult accept(ASTVisitor<InterpreterResult>& visitor) const
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	const std::string m_path;
 };
\ No newline at end of file
@@ -0,0 +1,675 @@
+#include "ASTCache.h"
+#include "MappedFile.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <random>
+#include <typeinfo>
+
+/*
+* Identifies compatible interpreters, a cache with another version is ignored. Bump it with every change to what is
+* written for a node (ASTWriter and ASTReader below), to the header, or to the meaning of the nodes the parser
+* produces, such as how names are qualified or what a position points at.
+*/
+static constexpr uint32_t format_version = 4;
+
+//Nested deeper than this the parser itself would have run out of stack
+static constexpr size_t max_depth = 10000;
+
+struct CacheHeader
+{
+	char magic[4];
+	uint32_t format_version;
+	uint64_t source_size;
+	uint64_t source_hash;
+	uint64_t payload_size;
+	uint64_t payload_hash;
+};
+
+enum class NodeTag : uint8_t
+{
+	NONE,
+	LITERAL,
+	IDENTIFIER,
+	UNARY,
+	BINARY,
+	LET,
+	FUNCTION,
+	CALL,
+	RETURN,
+	ASSIGNMENT,
+	IF,
+	WHILE,
+	PRINT,
+	CAST,
+	INPUT,
+	BLOCK,
+	STRUCT,
+	FIELD,
+	FIELD_ASSIGNMENT,
+	SPAWN,
+	AWAIT,
+	YIELD,
+	IMPORT
+};
+
+enum class LiteralTag : uint8_t
+{
+	INT,
+	FLOAT,
+	CHAR,
+	STRING
+};
+
+static CacheHeader make_header(uint64_t source_size, uint64_t source_hash)
+{
+	CacheHeader header{};
+	std::memcpy(header.magic, "ASTC", 4);
+	header.format_version = format_version;
+	header.source_size = source_size;
+	header.source_hash = source_hash;
+	return header;
+}
+
+//Serializes nodes in pre order, children follow their parent
+struct ASTWriter : ASTVisitor<InterpreterResult>
+{
+	void put(const void* data, size_t size) { out.append(static_cast<const char*>(data), size); }
+	void put_u8(uint8_t value) { put(&value, sizeof(value)); }
+	void put_u32(uint32_t value) { put(&value, sizeof(value)); }
+	void patch_u32(size_t offset, uint32_t value) { std::memcpy(&out[offset], &value, sizeof(value)); }
+	void put_tag(NodeTag tag) { put_u8(static_cast<uint8_t>(tag)); }
+
+	void put_string(std::string_view value)
+	{
+		put_u32(static_cast<uint32_t>(value.size()));
+		put(value.data(), value.size());
+	}
+
+	void put_strings(const std::vector<std::string>& values)
+	{
+		put_u32(static_cast<uint32_t>(values.size()));
+		for (const auto& value : values)
+			put_string(value);
+	}
+
+	InterpreterResult put_node(const ASTNode* node)
+	{
+		if (!node)
+		{
+			put_tag(NodeTag::NONE);
+			return {};
+		}
+		return node->accept(*this);
+	}
+
+	InterpreterResult put_nodes(const std::vector<std::unique_ptr<ASTNode>>& nodes)
+	{
+		put_u32(static_cast<uint32_t>(nodes.size()));
+		for (const auto& node : nodes)
+		{
+			InterpreterResult res = put_node(node.get());
+			if (res.is_error())
+				return res;
+		}
+		return {};
+	}
+
+	InterpreterResult put_call(const ASTCallNode& node)
+	{
+		put_string(node.get_name());
+		return put_nodes(node.get_args());
+	}
+
+	InterpreterResult put_field(const ASTFieldNode& node)
+	{
+		put_string(node.get_field());
+		return put_node(node.get_object().get());
+	}
+
+	InterpreterResult visit(const ASTLiteralNode& node) override
+	{
+		put_tag(NodeTag::LITERAL);
+		const Value& value = *node.get_value();
+		if (typeid(value) == typeid(NumberValue<int>))
+		{
+			put_u8(static_cast<uint8_t>(LiteralTag::INT));
+			put(&static_cast<const NumberValue<int>&>(value).value, sizeof(int));
+		}
+		else if (typeid(value) == typeid(NumberValue<float>))
+		{
+			put_u8(static_cast<uint8_t>(LiteralTag::FLOAT));
+			put(&static_cast<const NumberValue<float>&>(value).value, sizeof(float));
+		}
+		else if (typeid(value) == typeid(NumberValue<char>))
+		{
+			put_u8(static_cast<uint8_t>(LiteralTag::CHAR));
+			put(&static_cast<const NumberValue<char>&>(value).value, sizeof(char));
+		}
+		else
+		{
+			put_u8(static_cast<uint8_t>(LiteralTag::STRING));
+			put_string(static_cast<const StringValue&>(value).text);
+		}
+		return {};
+	}
+
+	InterpreterResult visit(const ASTIdentifierNode& node) override
+	{
+		put_tag(NodeTag::IDENTIFIER);
+		put_string(node.get_name());
+		return {};
+	}
+
+	InterpreterResult visit(const ASTUnaryNode& node) override
+	{
+		put_tag(NodeTag::UNARY);
+		put_u8(static_cast<uint8_t>(node.get_operator()));
+		return put_node(node.get_operand().get());
+	}
+
+	InterpreterResult visit(const ASTBinaryNode& node) override
+	{
+		put_tag(NodeTag::BINARY);
+		put_u8(static_cast<uint8_t>(node.get_operator()));
+		InterpreterResult res = put_node(node.get_lhs().get());
+		if (res.is_error())
+			return res;
+		return put_node(node.get_rhs().get());
+	}
+
+	InterpreterResult visit(const ASTLetNode& node) override
+	{
+		put_tag(NodeTag::LET);
+		put_string(node.get_var_name());
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTFunctionNode& node) override
+	{
+		//Lazily parsed bodies are parsed now, a body with errors can't be cached
+		auto body = node.get_body();
+		if (body.is_error())
+			return body.get_error();
+
+		put_tag(NodeTag::FUNCTION);
+		put_string(node.get_name());
+		put_strings(node.get_args());
+		put_u8(node.is_generator());
+
+		//The size of the body comes first so that loading can skip it
+		size_t size_offset = out.size();
+		put_u32(0);
+		InterpreterResult res = put_nodes((*body)->get_stmts());
+		patch_u32(size_offset, static_cast<uint32_t>(out.size() - size_offset - sizeof(uint32_t)));
+		return res;
+	}
+
+	InterpreterResult visit(const ASTCallNode& node) override
+	{
+		put_tag(NodeTag::CALL);
+		return put_call(node);
+	}
+
+	InterpreterResult visit(const ASTReturnNode& node) override
+	{
+		put_tag(NodeTag::RETURN);
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTAssignmentNode& node) override
+	{
+		put_tag(NodeTag::ASSIGNMENT);
+		put_string(node.get_variable()->get_name());
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTIfNode& node) override
+	{
+		put_tag(NodeTag::IF);
+		InterpreterResult res = put_node(node.get_conditon().get());
+		if (res.is_error())
+			return res;
+		InterpreterResult then_res = put_node(node.get_then_stmt().get());
+		if (then_res.is_error())
+			return then_res;
+		return put_node(node.get_else_stmt().get());
+	}
+
+	InterpreterResult visit(const ASTWhileNode& node) override
+	{
+		put_tag(NodeTag::WHILE);
+		put_u32(static_cast<uint32_t>(node.get_position()));
+		InterpreterResult res = put_node(node.get_conditon().get());
+		if (res.is_error())
+			return res;
+		return put_node(node.get_then_stmt().get());
+	}
+
+	InterpreterResult visit(const ASTPrintNode& node) override
+	{
+		put_tag(NodeTag::PRINT);
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTCastNode& node) override
+	{
+		put_tag(NodeTag::CAST);
+		put_u8(static_cast<uint8_t>(node.get_type()));
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTInputNode&) override
+	{
+		put_tag(NodeTag::INPUT);
+		return {};
+	}
+
+	InterpreterResult visit(const ASTBlockNode& node) override
+	{
+		put_tag(NodeTag::BLOCK);
+		return put_nodes(node.get_stmts());
+	}
+
+	InterpreterResult visit(const ASTStructNode& node) override
+	{
+		put_tag(NodeTag::STRUCT);
+		put_string(node.get_layout()->get_name());
+		put_strings(node.get_layout()->get_fields());
+		return {};
+	}
+
+	InterpreterResult visit(const ASTFieldNode& node) override
+	{
+		put_tag(NodeTag::FIELD);
+		return put_field(node);
+	}
+
+	InterpreterResult visit(const ASTFieldAssignmentNode& node) override
+	{
+		put_tag(NodeTag::FIELD_ASSIGNMENT);
+		InterpreterResult res = put_field(*node.get_field());
+		if (res.is_error())
+			return res;
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTSpawnNode& node) override
+	{
+		put_tag(NodeTag::SPAWN);
+		return put_call(*node.get_call());
+	}
+
+	InterpreterResult visit(const ASTAwaitNode& node) override
+	{
+		put_tag(NodeTag::AWAIT);
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTYieldNode& node) override
+	{
+		put_tag(NodeTag::YIELD);
+		return put_node(node.get_expr().get());
+	}
+
+	InterpreterResult visit(const ASTImportNode& node) override
+	{
+		put_tag(NodeTag::IMPORT);
+		put_string(node.get_path());
+		return {};
+	}
+
+	std::string out;
+};
+
+//Rebuilds the nodes written by ASTWriter, every read is bounds checked and any inconsistency fails the whole load
+struct ASTReader
+{
+	bool get(void* data, size_t size)
+	{
+		if (failed || static_cast<size_t>(end - current) < size)
+			return fail();
+		std::memcpy(data, current, size);
+		current += size;
+		return true;
+	}
+
+	bool fail()
+	{
+		failed = true;
+		return false;
+	}
+
+	uint8_t get_u8()
+	{
+		uint8_t value = 0;
+		get(&value, sizeof(value));
+		return value;
+	}
+
+	uint32_t get_u32()
+	{
+		uint32_t value = 0;
+		get(&value, sizeof(value));
+		return value;
+	}
+
+	//Counts are checked against the remaining size so a corrupt count can't cause a huge allocation
+	uint32_t get_count()
+	{
+		uint32_t count = get_u32();
+		if (count > static_cast<size_t>(end - current))
+			fail();
+		return failed ? 0 : count;
+	}
+
+	std::string_view get_view()
+	{
+		uint32_t size = get_count();
+		std::string_view value(current, size);
+		current += size;
+		return value;
+	}
+
+	std::string get_string() { return std::string(get_view()); }
+
+	std::vector<std::string> get_strings()
+	{
+		std::vector<std::string> values(get_count());
+		for (auto& value : values)
+			value = get_string();
+		return values;
+	}
+
+	std::vector<std::unique_ptr<ASTNode>> get_nodes()
+	{
+		std::vector<std::unique_ptr<ASTNode>> nodes(get_count());
+		for (auto& node : nodes)
+			node = get_required_node();
+		return nodes;
+	}
+
+	Operator get_operator()
+	{
+		uint8_t op = get_u8();
+		if (op > static_cast<uint8_t>(Operator::OR))
+			fail();
+		return static_cast<Operator>(op);
+	}
+
+	std::unique_ptr<ASTNode> get_required_node()
+	{
+		std::unique_ptr<ASTNode> node = get_node();
+		if (!node)
+			fail();
+		return node;
+	}
+
+	ASTCallNode* get_call()
+	{
+		std::string name = get_string();
+		return new ASTCallNode(name, get_nodes());
+	}
+
+	ASTFieldNode* get_field()
+	{
+		std::string field = get_string();
+		return new ASTFieldNode(get_required_node().release(), field);
+	}
+
+	//Returns nullptr for NONE and on errors
+	std::unique_ptr<ASTNode> get_node()
+	{
+		if (++depth > max_depth)
+		{
+			fail();
+			return nullptr;
+		}
+		std::unique_ptr<ASTNode> node(get_node_contents());
+		--depth;
+
+		if (failed)
+			return nullptr;
+		return node;
+	}
+
+	ASTNode* get_node_contents()
+	{
+		//The arguments of a constructor are evaluated in any order, so everything is read into locals first
+		switch (static_cast<NodeTag>(get_u8()))
+		{
+		case NodeTag::NONE:
+			return nullptr;
+		case NodeTag::LITERAL:
+			switch (static_cast<LiteralTag>(get_u8()))
+			{
+			case LiteralTag::INT:
+			{
+				int value = 0;
+				get(&value, sizeof(value));
+				return new ASTLiteralNode(value);
+			}
+			case LiteralTag::FLOAT:
+			{
+				float value = 0;
+				get(&value, sizeof(value));
+				return new ASTLiteralNode(value);
+			}
+			case LiteralTag::CHAR:
+				return new ASTLiteralNode(static_cast<char>(get_u8()));
+			case LiteralTag::STRING:
+				//References the mapped cache like literals parsed from a mapped source
+				return new ASTLiteralNode(get_view(), owner);
+			}
+			break;
+		case NodeTag::IDENTIFIER:
+			return new ASTIdentifierNode(get_string());
+		case NodeTag::UNARY:
+		{
+			Operator op = get_operator();
+			return new ASTUnaryNode(op, get_required_node().release());
+		}
+		case NodeTag::BINARY:
+		{
+			Operator op = get_operator();
+			std::unique_ptr<ASTNode> lhs = get_required_node();
+			std::unique_ptr<ASTNode> rhs = get_required_node();
+			return new ASTBinaryNode(op, lhs.release(), rhs.release());
+		}
+		case NodeTag::LET:
+		{
+			std::string name = get_string();
+			return new ASTLetNode(name, get_required_node().release());
+		}
+		case NodeTag::FUNCTION:
+		{
+			std::string name = get_string();
+			std::vector<std::string> args = get_strings();
+			bool is_generator = get_u8() != 0;
+
+			//Bodies are only read when the function is first called, so loading is cheap however much code is never run
+			uint32_t size = get_count();
+			if (failed)
+				break;
+			const char* body_begin = current;
+			const char* body_end = current + size;
+			current = body_end;
+
+			std::shared_ptr<const void> body_owner = owner;
+			auto read_body = [body_begin, body_end, body_owner]() -> Result<ASTBlockNode*, Error>
+			{
+				ASTReader reader{ body_begin, body_end, body_owner };
+				std::vector<std::unique_ptr<ASTNode>> stmts = reader.get_nodes();
+				if (reader.failed || reader.current != reader.end)
+					return Error("Corrupt cache", 0);
+				return new ASTBlockNode(std::move(stmts));
+			};
+			return new ASTFunctionNode(name, args, read_body, is_generator);
+		}
+		case NodeTag::CALL:
+			return get_call();
+		case NodeTag::RETURN:
+			return new ASTReturnNode(get_node().release());
+		case NodeTag::ASSIGNMENT:
+		{
+			std::string name = get_string();
+			return new ASTAssignmentNode(new ASTIdentifierNode(name), get_required_node().release());
+		}
+		case NodeTag::IF:
+		{
+			std::unique_ptr<ASTNode> condition = get_required_node();
+			std::unique_ptr<ASTNode> then_stmt = get_required_node();
+			std::unique_ptr<ASTNode> else_stmt = get_node();
+			return new ASTIfNode(condition.release(), then_stmt.release(), else_stmt.release());
+		}
+		case NodeTag::WHILE:
+		{
+			uint32_t position = get_u32();
+			std::unique_ptr<ASTNode> condition = get_required_node();
+			std::unique_ptr<ASTNode> then_stmt = get_required_node();
+			return new ASTWhileNode(condition.release(), then_stmt.release(), position);
+		}
+		case NodeTag::PRINT:
+			return new ASTPrintNode(get_required_node().release());
+		case NodeTag::CAST:
+		{
+			uint8_t type = get_u8();
+			if (type > static_cast<uint8_t>(Type::STRING))
+				break;
+			return new ASTCastNode(static_cast<Type>(type), get_required_node().release());
+		}
+		case NodeTag::INPUT:
+			return new ASTInputNode();
+		case NodeTag::BLOCK:
+			return new ASTBlockNode(get_nodes());
+		case NodeTag::STRUCT:
+		{
+			std::string name = get_string();
+			return new ASTStructNode(name, get_strings());
+		}
+		case NodeTag::FIELD:
+			return get_field();
+		case NodeTag::FIELD_ASSIGNMENT:
+		{
+			std::unique_ptr<ASTFieldNode> field(get_field());
+			return new ASTFieldAssignmentNode(field.release(), get_required_node().release());
+		}
+		case NodeTag::SPAWN:
+			return new ASTSpawnNode(get_call());
+		case NodeTag::AWAIT:
+			return new ASTAwaitNode(get_required_node().release());
+		case NodeTag::YIELD:
+			return new ASTYieldNode(get_required_node().release());
+		case NodeTag::IMPORT:
+			return new ASTImportNode(get_string());
+		}
+
+		fail();
+		return nullptr;
+	}
+
+	const char* current;
+	const char* end;
+	std::shared_ptr<const void> owner;
+	size_t depth = 0;
+	bool failed = false;
+};
+
+ASTCache::ASTCache(const std::string& source_path, const std::string& cache_dir, std::string_view source, std::string_view name_space)
+	: m_source_size(source.size())
+	, m_source_hash(hash(source) ^ hash(name_space))
+{
+	if (cache_dir.empty())
+		m_path = source_path + ".cache";
+	else
+	{
+		char name[32];
+		std::snprintf(name, sizeof(name), "%016llx.cache", static_cast<unsigned long long>(m_source_hash));
+		m_path = (std::filesystem::path(cache_dir) / name).string();
+	}
+}
+
+Result<std::vector<std::unique_ptr<ASTNode>>, const char*> ASTCache::load() const
+{
+	std::shared_ptr<MappedFile> file = MappedFile::open(m_path);
+	if (!file)
+		return "No cache";
+
+	CacheHeader header;
+	if (file->size() < sizeof(header))
+		return "Corrupt cache";
+	std::memcpy(&header, file->data(), sizeof(header));
+
+	CacheHeader expected = make_header(m_source_size, m_source_hash);
+	if (std::memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0 || header.format_version != expected.format_version)
+		return "Cache from another interpreter";
+	if (header.source_size != expected.source_size || header.source_hash != expected.source_hash)
+		return "Stale cache";
+
+	std::string_view payload = file->view().substr(sizeof(header));
+	if (header.payload_size != payload.size() || header.payload_hash != hash(payload))
+		return "Corrupt cache";
+
+	ASTReader reader{ payload.data(), payload.data() + payload.size(), file };
+	std::vector<std::unique_ptr<ASTNode>> program = reader.get_nodes();
+	if (reader.failed || reader.current != reader.end)
+		return "Corrupt cache";
+	return program;
+}
+
+bool ASTCache::store(const std::vector<std::unique_ptr<ASTNode>>& program) const
+{
+	ASTWriter writer;
+	if (writer.put_nodes(program).is_error())
+		return false;
+
+	CacheHeader header = make_header(m_source_size, m_source_hash);
+	header.payload_size = writer.out.size();
+	header.payload_hash = hash(writer.out);
+
+	std::filesystem::path path(m_path);
+	std::error_code error;
+	if (path.has_parent_path())
+		std::filesystem::create_directories(path.parent_path(), error);
+
+	//Written next to the cache under a unique name and renamed over it once complete
+	std::string temp_path = m_path + "." + std::to_string(std::random_device()()) + ".tmp";
+	FILE* file = std::fopen(temp_path.c_str(), "wb");
+	if (!file)
+		return false;
+
+	bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+		std::fwrite(writer.out.data(), 1, writer.out.size(), file) == writer.out.size();
+	written = std::fclose(file) == 0 && written;
+
+	if (written)
+		std::filesystem::rename(temp_path, path, error);
+	if (!written || error)
+	{
+		std::remove(temp_path.c_str());
+		return false;
+	}
+	return true;
+}
+
+uint64_t ASTCache::hash(std::string_view data)
+{
+	const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+	uint64_t h = data.size() * multiplier;
+
+	size_t i = 0;
+	for (; i + sizeof(uint64_t) <= data.size(); i += sizeof(uint64_t))
+	{
+		uint64_t word;
+		std::memcpy(&word, data.data() + i, sizeof(word));
+		h = (h ^ word) * multiplier;
+		h ^= h >> 29;
+	}
+
+	uint64_t tail = 0;
+	if (i < data.size())
+		std::memcpy(&tail, data.data() + i, data.size() - i);
+	h = (h ^ tail) * multiplier;
+	return h ^ (h >> 32);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AST.h"
+#include "Result.h"
+
+/*
+* Parsed programs cached on disk so unchanged sources don't have to be lexed and parsed again.
+* The cache file starts with a header holding the format version, the size and hash of the source and a
+* checksum of the rest of the file. A cache whose header doesn't match the current source and format, or
+* whose checksum is wrong, is ignored and replaced.
+* The file is mapped when it is loaded and string literals reference the mapping instead of being copied.
+* Function bodies are only read from the mapping when the function is first called.
+*/
+class ASTCache
+{
+public:
+	/*
+	* The cache of "source" (the contents of "source_path") is stored as <source_path>.cache, or in
+	* "cache_dir" named after the hash of the source if a directory is given.
+	* Modules are parsed with the names they declare prefixed with their namespace, which is part of the key.
+	*/
+	ASTCache(const std::string& source_path, const std::string& cache_dir, std::string_view source, std::string_view name_space = {});
+
+	inline const std::string& get_path() const { return m_path; }
+
+	//Returns the cached program, or why there is no usable cache
+	Result<std::vector<std::unique_ptr<ASTNode>>, const char*> load() const;
+
+	/*
+	* Writes the program to the cache, replacing the file only once it is complete so concurrent readers
+	* never see a partial cache. Lazily parsed functions are parsed first, if one of them has a syntax
+	* error nothing is written.
+	*/
+	bool store(const std::vector<std::unique_ptr<ASTNode>>& program) const;
+
+	//Fast non cryptographic hash used for the sources and the checksums
+	static uint64_t hash(std::string_view data);
+
+private:
+	std::string m_path;
+	uint64_t m_source_size;
+	uint64_t m_source_hash;
+};
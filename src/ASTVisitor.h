@@ -21,4 +21,11 @@ public:
 	virtual T visit(const class ASTFunctionNode&) = 0;
 	virtual T visit(const class ASTCallNode&) = 0;
 	virtual T visit(const class ASTReturnNode&) = 0;
+	virtual T visit(const class ASTStructNode&) = 0;
+	virtual T visit(const class ASTFieldNode&) = 0;
+	virtual T visit(const class ASTFieldAssignmentNode&) = 0;
+	virtual T visit(const class ASTSpawnNode&) = 0;
+	virtual T visit(const class ASTAwaitNode&) = 0;
+	virtual T visit(const class ASTYieldNode&) = 0;
+	virtual T visit(const class ASTImportNode&) = 0;
 };
\ No newline at end of file
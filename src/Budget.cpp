@@ -0,0 +1,45 @@
+#include "Budget.h"
+
+#include <algorithm>
+
+//The clock and the memory are read once per chunk, a step takes somewhere between 50 ns and a few microseconds
+static constexpr uint64_t steps_per_chunk = 4096;
+
+Budget::Budget(const Limits& limits)
+	: m_limits(limits)
+	, m_deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(limits.max_milliseconds))
+	, m_memory(limits.max_memory != 0 ? std::make_shared<MemoryAccount>() : nullptr)
+{}
+
+const char* Budget::charge(uint64_t n_steps, uint64_t& next_chunk)
+{
+	next_chunk = steps_per_chunk;
+	if (const char* error = get_error())
+		return error;
+
+	if (m_limits.max_steps != 0)
+	{
+		//The next charge happens exactly on the first step over the limit
+		uint64_t steps = m_steps.fetch_add(n_steps, std::memory_order_relaxed) + n_steps;
+		if (steps > m_limits.max_steps)
+			return fail("Step limit exceeded");
+		next_chunk = std::min(next_chunk, m_limits.max_steps - steps + 1);
+	}
+
+	if (m_limits.max_milliseconds != 0 && std::chrono::steady_clock::now() >= m_deadline)
+		return fail("Time limit exceeded");
+
+	if (m_memory && m_memory->get_bytes() > m_limits.max_memory)
+		return fail("Memory limit exceeded");
+
+	return nullptr;
+}
+
+const char* Budget::fail(const char* error)
+{
+	//The first exceeded limit is the one reported by every interpreter
+	const char* expected = nullptr;
+	if (!m_error.compare_exchange_strong(expected, error))
+		return expected;
+	return error;
+}
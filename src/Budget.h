@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+#include "MemoryAccount.h"
+
+/*
+* The limits of one execution of a program. Steps are loop iterations and function calls, the interpreter and its
+* workers take them in chunks (see Interpreter::take_step) so the shared counter and the clock are only touched
+* once per chunk. Once a limit is exceeded the budget stays exceeded and every interpreter using it stops.
+*/
+class Budget
+{
+public:
+	struct Limits
+	{
+		//0 means unlimited
+		uint64_t max_steps = 0;
+		uint64_t max_milliseconds = 0;
+		//The bytes held by the values of the execution, see MemoryAccount
+		size_t max_memory = 0;
+	};
+
+	//The deadline starts now
+	explicit Budget(const Limits& limits);
+
+	inline const Limits& get_limits() const { return m_limits; }
+
+	//Values are charged to it while the interpreters using the budget run (see MemoryAccount::Scope), null without a memory limit
+	inline const std::shared_ptr<MemoryAccount>& get_memory() const { return m_memory; }
+
+	/*
+	* Takes "n_steps" steps and checks all limits, returns the error of the exceeded limit or nullptr.
+	* "next_chunk" is set to the number of steps to take before charging again.
+	*/
+	const char* charge(uint64_t n_steps, uint64_t& next_chunk);
+
+	//The error of the exceeded limit, nullptr while the budget lasts
+	inline const char* get_error() const { return m_error.load(std::memory_order_relaxed); }
+
+private:
+	const char* fail(const char* error);
+
+	Limits m_limits;
+	std::chrono::steady_clock::time_point m_deadline;
+	std::atomic<uint64_t> m_steps{ 0 };
+	std::atomic<const char*> m_error{ nullptr };
+	std::shared_ptr<MemoryAccount> m_memory;
+};
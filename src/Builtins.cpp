@@ -0,0 +1,443 @@
+#include "Interpreter.h"
+#include "MappedFile.h"
+
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+
+/*
+* Builtin functions are looked up after user defined functions so a script can shadow them.
+* Arguments are always dereferenced before they are passed to the native function.
+*/
+
+static MapValue* as_map(const std::shared_ptr<Value>& value)
+{
+	return dynamic_cast<MapValue*>(value.get());
+}
+
+static const NumberValue<int>* as_int(const std::shared_ptr<Value>& value)
+{
+	return dynamic_cast<const NumberValue<int>*>(value.get());
+}
+
+static const StringValue* as_string(const std::shared_ptr<Value>& value)
+{
+	return dynamic_cast<const StringValue*>(value.get());
+}
+
+//Sizes of files can exceed the range of int, those are returned as an approximate float
+static std::shared_ptr<Value> make_count(size_t count)
+{
+	if (count <= static_cast<size_t>(INT_MAX))
+		return std::make_shared<NumberValue<int>>(static_cast<int>(count));
+	return std::make_shared<NumberValue<float>>(static_cast<float>(count));
+}
+
+void Interpreter::register_builtins()
+{
+	/*
+	* MAP
+	*/
+
+	//map() -> empty map
+	definitions->builtin_table["map"] = { 0, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>&) -> InterpreterResult
+	{
+		return { interpreter.allocate<MapValue>() };
+	} };
+
+	//map_set(m, key, value) -> 1 if the key was inserted, 0 if an existing value was replaced
+	definitions->builtin_table["map_set"] = { 3, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		if (!map)
+			return "Expected map as first argument";
+
+		MapKey key;
+		if (!MapValue::to_key(*args[1], key))
+			return "Map keys must be int, char or string";
+
+		if (dynamic_cast<VoidValue*>(args[2].get()))
+			return "Value is void";
+
+		bool inserted = map->insert_or_assign(std::move(key), args[2]);
+		return { std::make_shared<NumberValue<int>>(inserted) };
+	} };
+
+	//map_get(m, key) -> value stored at key
+	definitions->builtin_table["map_get"] = { 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		if (!map)
+			return "Expected map as first argument";
+
+		MapKey key;
+		if (!MapValue::to_key(*args[1], key))
+			return "Map keys must be int, char or string";
+
+		if (std::shared_ptr<Value>* value = map->entries.find(key))
+			return *value;
+		return "Key does not exist in map";
+	} };
+
+	//map_has(m, key) -> 1 if key exists, otherwise 0
+	definitions->builtin_table["map_has"] = { 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		if (!map)
+			return "Expected map as first argument";
+
+		MapKey key;
+		if (!MapValue::to_key(*args[1], key))
+			return "Map keys must be int, char or string";
+
+		return { std::make_shared<NumberValue<int>>(map->entries.find(key) != nullptr) };
+	} };
+
+	//map_erase(m, key) -> 1 if key was removed, otherwise 0
+	definitions->builtin_table["map_erase"] = { 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		if (!map)
+			return "Expected map as first argument";
+
+		MapKey key;
+		if (!MapValue::to_key(*args[1], key))
+			return "Map keys must be int, char or string";
+
+		return { std::make_shared<NumberValue<int>>(map->erase(key)) };
+	} };
+
+	//map_size(m) -> number of entries
+	definitions->builtin_table["map_size"] = { 1, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		if (!map)
+			return "Expected map as first argument";
+
+		return { std::make_shared<NumberValue<int>>(static_cast<int>(map->entries.size())) };
+	} };
+
+	/*
+	* Iteration is done with slot cursors:
+	* let i := map_next(m, 0);
+	* while (i >= 0) { print map_key(m, i); i := map_next(m, i + 1); };
+	*/
+
+	//map_next(m, slot) -> first occupied slot at or after "slot", -1 when there are no more entries
+	definitions->builtin_table["map_next"] = { 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		const NumberValue<int>* from = as_int(args[1]);
+		if (!map || !from)
+			return "Expected map and int slot";
+		if (from->value < 0)
+			return "Slot out of range";
+
+		size_t slot = map->entries.next_slot(from->value);
+		if (slot == map->entries.capacity())
+			return { std::make_shared<NumberValue<int>>(-1) };
+		return { std::make_shared<NumberValue<int>>(static_cast<int>(slot)) };
+	} };
+
+	//map_key(m, slot) -> key stored in slot
+	definitions->builtin_table["map_key"] = { 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		const NumberValue<int>* slot = as_int(args[1]);
+		if (!map || !slot)
+			return "Expected map and int slot";
+		if (slot->value < 0 || !map->entries.is_occupied(slot->value))
+			return "Slot is empty";
+
+		return MapValue::from_key(map->entries.key_at(slot->value));
+	} };
+
+	//map_value(m, slot) -> value stored in slot
+	definitions->builtin_table["map_value"] = { 2, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		const NumberValue<int>* slot = as_int(args[1]);
+		if (!map || !slot)
+			return "Expected map and int slot";
+		if (slot->value < 0 || !map->entries.is_occupied(slot->value))
+			return "Slot is empty";
+
+		return map->entries.value_at(slot->value);
+	} };
+
+	/*
+	* PARALLEL
+	* The function is passed by name and runs on worker interpreters, see Interpreter::create_worker.
+	* Workers can read the global variables but assignments to them are not visible to the caller.
+	*/
+
+	//parallel_for(lo, hi, "fn") -> calls fn(i) for every i in [lo, hi)
+	definitions->builtin_table["parallel_for"] = { 3, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		const NumberValue<int>* lo = as_int(args[0]);
+		const NumberValue<int>* hi = as_int(args[1]);
+		const StringValue* fn_name = as_string(args[2]);
+		if (!lo || !hi || !fn_name)
+			return "Expected int, int and function name";
+
+		auto function_it = interpreter.definitions->function_table.find(std::string(fn_name->text));
+		if (function_it == interpreter.definitions->function_table.end())
+			return "Function does not exist";
+		if (function_it->second.arg_names->size() != 1)
+			return "Incorrect number of arguments in function call";
+
+		const Function& func = function_it->second;
+		if (hi->value <= lo->value)
+			return { interpreter.void_val };
+
+		//Report the error of the lowest index so the result doesn't depend on scheduling
+		std::mutex error_mutex;
+		size_t error_index = static_cast<size_t>(-1);
+		const char* error = nullptr;
+
+		auto run_chunk = [&](size_t begin, size_t end)
+		{
+			std::unique_ptr<Interpreter> worker = interpreter.create_worker();
+			MemoryAccount::Scope memory = worker->account_memory();
+			for (size_t i = begin; i < end; ++i)
+			{
+				//lo + i is inside [lo, hi) so it fits an int, only the sum has to be wide
+				int value = static_cast<int>(static_cast<int64_t>(lo->value) + static_cast<int64_t>(i));
+				InterpreterResult res = worker->call_function(func, { std::make_shared<NumberValue<int>>(value) });
+				if (res.is_error())
+				{
+					std::lock_guard<std::mutex> lock(error_mutex);
+					if (i < error_index)
+					{
+						error_index = i;
+						error = res.get_error();
+					}
+					return;
+				}
+			}
+		};
+
+		//The range of two ints can exceed an int, hi > lo so the wide difference is positive
+		size_t n = static_cast<size_t>(static_cast<int64_t>(hi->value) - static_cast<int64_t>(lo->value));
+		if (interpreter.pool)
+			interpreter.pool->parallel_for(0, n, run_chunk);
+		else
+			run_chunk(0, n);
+
+		if (error)
+			return error;
+		return { interpreter.void_val };
+	} };
+
+	//parallel_map(m, "fn") -> new map with the same keys where every value is fn(value)
+	definitions->builtin_table["parallel_map"] = { 2, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		MapValue* map = as_map(args[0]);
+		const StringValue* fn_name = as_string(args[1]);
+		if (!map || !fn_name)
+			return "Expected map and function name";
+
+		auto function_it = interpreter.definitions->function_table.find(std::string(fn_name->text));
+		if (function_it == interpreter.definitions->function_table.end())
+			return "Function does not exist";
+		if (function_it->second.arg_names->size() != 1)
+			return "Incorrect number of arguments in function call";
+
+		const Function& func = function_it->second;
+
+		std::vector<size_t> slots;
+		slots.reserve(map->entries.size());
+		for (size_t slot = map->entries.next_slot(0); slot < map->entries.capacity(); slot = map->entries.next_slot(slot + 1))
+			slots.push_back(slot);
+
+		std::vector<std::shared_ptr<Value>> results(slots.size());
+		std::vector<const char*> errors(slots.size(), nullptr);
+
+		auto run_chunk = [&](size_t begin, size_t end)
+		{
+			std::unique_ptr<Interpreter> worker = interpreter.create_worker();
+			MemoryAccount::Scope memory = worker->account_memory();
+			for (size_t i = begin; i < end; ++i)
+			{
+				InterpreterResult res = worker->call_function(func, { map->entries.value_at(slots[i]) });
+				if (res.is_error())
+				{
+					errors[i] = res.get_error();
+					return;
+				}
+				results[i] = *res;
+			}
+		};
+
+		if (interpreter.pool)
+			interpreter.pool->parallel_for(0, slots.size(), run_chunk);
+		else
+			run_chunk(0, slots.size());
+
+		auto result_map = interpreter.allocate<MapValue>();
+		for (size_t i = 0; i < slots.size(); ++i)
+		{
+			if (errors[i])
+				return errors[i];
+			if (dynamic_cast<VoidValue*>(results[i].get()))
+				return "Value is void";
+			result_map->insert_or_assign(map->entries.key_at(slots[i]), results[i]);
+		}
+
+		return { result_map };
+	} };
+
+	/*
+	* GENERATORS
+	* while (has_next(g)) { print next(g); };
+	*/
+
+	//has_next(g) -> 1 if the generator yields another value, runs the generator until that yield
+	definitions->builtin_table["has_next"] = { 1, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		auto* generator = dynamic_cast<GeneratorValue*>(args[0].get());
+		if (!generator)
+			return "Expected generator";
+
+		if (!generator->buffered && !generator->finished)
+		{
+			InterpreterResult res = interpreter.resume_generator(*generator);
+			if (res.is_error())
+				return res;
+			if (!generator->finished)
+				generator->buffered = *res;
+		}
+
+		return { std::make_shared<NumberValue<int>>(generator->buffered != nullptr) };
+	} };
+
+	//next(g) -> the next value yielded by the generator
+	definitions->builtin_table["next"] = { 1, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		auto* generator = dynamic_cast<GeneratorValue*>(args[0].get());
+		if (!generator)
+			return "Expected generator";
+
+		if (generator->buffered)
+		{
+			std::shared_ptr<Value> value = std::move(generator->buffered);
+			generator->buffered = nullptr;
+			return value;
+		}
+
+		InterpreterResult res = interpreter.resume_generator(*generator);
+		if (res.is_error())
+			return res;
+		if (generator->finished)
+			return "Generator has no more values";
+		return res;
+	} };
+
+	/*
+	* FILES
+	* Files are mapped into memory, strings read from them reference the mapping instead of copying it.
+	*/
+
+	//open_lines(path) -> generator which yields the lines of the file one at a time
+	definitions->builtin_table["open_lines"] = { 1, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		const StringValue* path = as_string(args[0]);
+		if (!path)
+			return "Expected path as string";
+
+		std::shared_ptr<MappedFile> file = MappedFile::open(std::string(path->text));
+		if (!file)
+			return "Cannot open file";
+
+		//Pages behind the current line are released every few MB so scanning a file of any size uses the same memory
+		static constexpr size_t release_interval = 16 << 20;
+		size_t position = 0;
+		size_t released = 0;
+		return { interpreter.allocate<GeneratorValue>([file, position, released]() mutable -> std::shared_ptr<Value>
+		{
+			if (position >= file->size())
+				return nullptr;
+
+			const char* begin = file->data() + position;
+			const char* newline = static_cast<const char*>(std::memchr(begin, '\n', file->size() - position));
+			const char* end = newline ? newline : file->data() + file->size();
+			position = end - file->data() + (newline ? 1 : 0);
+
+			if (position - released >= release_interval)
+			{
+				file->release(released, position);
+				released = position;
+			}
+
+			if (end != begin && end[-1] == '\r')
+				--end;
+			return std::make_shared<StringValue>(std::string_view(begin, end - begin), file);
+		}) };
+	} };
+
+	//read_all(path) -> the contents of the file as a string
+	definitions->builtin_table["read_all"] = { 1, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		const StringValue* path = as_string(args[0]);
+		if (!path)
+			return "Expected path as string";
+
+		std::shared_ptr<MappedFile> file = MappedFile::open(std::string(path->text));
+		if (!file)
+			return "Cannot open file";
+
+		return { std::make_shared<StringValue>(file->view(), file) };
+	} };
+
+	//byte_count(path) -> size of the file in bytes
+	definitions->builtin_table["byte_count"] = { 1, [](Interpreter&, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		const StringValue* path = as_string(args[0]);
+		if (!path)
+			return "Expected path as string";
+
+		std::shared_ptr<MappedFile> file = MappedFile::open(std::string(path->text));
+		if (!file)
+			return "Cannot open file";
+
+		return { make_count(file->size()) };
+	} };
+
+	//line_count(path) -> number of lines in the file, a last line without a line break counts as well
+	definitions->builtin_table["line_count"] = { 1, [](Interpreter& interpreter, const std::vector<std::shared_ptr<Value>>& args) -> InterpreterResult
+	{
+		const StringValue* path = as_string(args[0]);
+		if (!path)
+			return "Expected path as string";
+
+		std::shared_ptr<MappedFile> file = MappedFile::open(std::string(path->text));
+		if (!file)
+			return "Cannot open file";
+
+		//Chunks of the file are counted in parallel, each chunk releases the pages it has counted as it goes
+		static constexpr size_t block_size = 16 << 20;
+		std::atomic<size_t> n_lines(0);
+		auto count_chunk = [&](size_t begin, size_t end)
+		{
+			for (size_t block = begin; block < end; block += block_size)
+			{
+				size_t block_end = std::min(end, block + block_size);
+				n_lines += std::count(file->data() + block, file->data() + block_end, '\n');
+				file->release(block, block_end);
+			}
+		};
+
+		if (interpreter.pool)
+			interpreter.pool->parallel_for(0, file->size(), count_chunk);
+		else
+			count_chunk(0, file->size());
+
+		size_t count = n_lines;
+		if (file->size() != 0 && file->data()[file->size() - 1] != '\n')
+			++count;
+		return { make_count(count) };
+	} };
+}
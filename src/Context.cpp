@@ -0,0 +1,52 @@
+#include "Context.h"
+#include "InstrumentedInterpreter.h"
+
+#include <thread>
+
+Context::Context(std::shared_ptr<const Program> program, OutputBuffer& output, InputBuffer& input, ThreadPool& pool, Instrumentation* instrumentation)
+	: m_program(std::move(program))
+	, m_output(output)
+	, m_pool(pool)
+	, m_modules(m_program->get_path())
+	, m_interpreter(instrumentation
+		? instrumentation->create_interpreter(output, input, &pool, &m_modules)
+		: std::make_unique<Interpreter>(output, input, &pool, &m_modules))
+{
+	m_modules.set_lazy_functions(m_program->get_options().lazy_functions);
+	m_modules.set_cache_dir(m_program->get_options().cache_dir);
+}
+
+Context::~Context()
+{
+	wait();
+}
+
+void Context::wait()
+{
+	//Only waits for the tasks of this context, helping with whatever is queued instead of blocking since they may be
+	//queued behind tasks of other contexts sharing the pool
+	while (m_interpreter->has_running_tasks())
+	{
+		if (!m_pool.try_run_one())
+			std::this_thread::yield();
+	}
+}
+
+bool Context::run()
+{
+	bool succeeded = true;
+	for (const auto& stmt : m_program->get_statements())
+	{
+		const auto& res = m_interpreter->interpret(*stmt);
+		if (res.is_error())
+		{
+			m_output.write(std::string(res.get_error()) + "\n");
+			succeeded = false;
+
+			//An exceeded limit aborts the rest of the program
+			if (m_interpreter->get_abort_error())
+				break;
+		}
+	}
+	return succeeded;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "Interpreter.h"
+#include "ModuleLoader.h"
+#include "Program.h"
+
+class Instrumentation;
+
+/*
+* One execution of a program with its own variables, definitions, heap and imported modules. A context is used by
+* one thread at a time while any number of other contexts run the same program, contexts share nothing but the
+* program and the pool.
+*/
+class Context
+{
+public:
+	/*
+	* Printed values are written to "output" and input reads its lines from "input". Spawned tasks, the parallel
+	* builtins and the parsing of imported modules run on "pool". With "instrumentation" the program runs on an
+	* interpreter it creates, see InstrumentedInterpreter.
+	*/
+	Context(std::shared_ptr<const Program> program, OutputBuffer& output, InputBuffer& input, ThreadPool& pool, Instrumentation* instrumentation = nullptr);
+
+	//Waits for the tasks spawned by the program, they reference the context
+	~Context();
+	void wait();
+
+	Context(const Context&) = delete;
+	Context& operator=(const Context&) = delete;
+
+	/*
+	* Runs the top level statements, runtime errors are written to the output. Returns false if any statement failed.
+	* Exceeding a limit (see Interpreter::set_limits) stops the program after the statement which exceeded it.
+	*/
+	bool run();
+
+	/*
+	* Resolves a function declared by the program (after run) or by one of its imports, so the host can call it
+	* repeatedly without looking it up by name. Returns nothing if there is no such function.
+	*/
+	inline std::optional<Interpreter::Function> find_function(const std::string& name) const { return m_interpreter->find_function(name); }
+
+	/*
+	* Calls a resolved function with native arguments (int, float, char, strings or values). Maps and records
+	* returned to the host are only safe to keep until the context runs statements again, which may collect them.
+	*/
+	template <typename... Args>
+	InterpreterResult call(const Interpreter::Function& func, Args&&... args)
+	{
+		//The arguments are copied into the scope of the call before it runs, so nested calls can reuse the vector
+		m_args.clear();
+		(m_args.push_back(to_value(std::forward<Args>(args))), ...);
+		return m_interpreter->call(func, m_args);
+	}
+
+	//Makes "fn" callable from the program like a builtin, see Interpreter::register_native
+	inline void register_function(const std::string& name, size_t n_args, Interpreter::NativeFunction fn)
+	{
+		m_interpreter->register_native(name, n_args, std::move(fn));
+	}
+
+	inline Interpreter& get_interpreter() { return *m_interpreter; }
+	inline const std::shared_ptr<const Program>& get_program() const { return m_program; }
+
+private:
+	static inline std::shared_ptr<Value> to_value(int value) { return std::make_shared<NumberValue<int>>(value); }
+	static inline std::shared_ptr<Value> to_value(float value) { return std::make_shared<NumberValue<float>>(value); }
+	static inline std::shared_ptr<Value> to_value(double value) { return std::make_shared<NumberValue<float>>(static_cast<float>(value)); }
+	static inline std::shared_ptr<Value> to_value(char value) { return std::make_shared<NumberValue<char>>(value); }
+	static inline std::shared_ptr<Value> to_value(std::string value) { return std::make_shared<StringValue>(std::move(value)); }
+	static inline std::shared_ptr<Value> to_value(const char* value) { return std::make_shared<StringValue>(std::string(value)); }
+	static inline std::shared_ptr<Value> to_value(std::shared_ptr<Value> value) { return value; }
+
+	std::shared_ptr<const Program> m_program;
+	OutputBuffer& m_output;
+	ThreadPool& m_pool;
+	ModuleLoader m_modules;
+	std::unique_ptr<Interpreter> m_interpreter;
+	std::vector<std::shared_ptr<Value>> m_args;
+};
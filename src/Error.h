@@ -3,8 +3,8 @@
 struct Error
 {
 	Error(const char* message, size_t position) 
-		: message(message)
-		, position(position)
+		: position(position)
+		, message(message)
 	{}
 
 	size_t position;
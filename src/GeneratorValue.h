@@ -0,0 +1,64 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+
+#include "AST.h"
+#include "ScopeManager.h"
+#include "Value.h"
+
+/*
+* A suspended call of a generator function (a function containing "yield").
+* The generator does not keep any native stack while suspended. Instead the position in the body
+* is stored as an explicit stack of frames, one for every block, if or while statement that is being
+* executed, together with the scopes of the call. The frame stack is never deeper than the statement
+* nesting of the function body so a suspended generator only needs a small, bounded amount of memory.
+* See Interpreter::resume_generator.
+*/
+class GeneratorValue : public Value
+{
+public:
+	struct Frame
+	{
+		const ASTNode* node;
+		size_t pc; //Next statement of a block, or 1 if the branch of an if statement was started
+	};
+
+	GeneratorValue(const ASTBlockNode* body)
+		: m_memory(sizeof(GeneratorValue))
+	{
+		frames.push_back({ body, 0 });
+		scope_manager.push_scope();
+		STATS_ALLOCATION(Generator);
+	}
+
+	//Generators implemented in C++ (such as open_lines) get their values from "native", it returns nullptr when it is done
+	using NativeSource = std::function<std::shared_ptr<Value>()>;
+
+	GeneratorValue(NativeSource native)
+		: native(std::move(native))
+		, m_memory(sizeof(GeneratorValue))
+	{
+		STATS_ALLOCATION(Generator);
+	}
+
+	inline virtual bool is_truthy() const override { return true; }
+	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
+	{
+		return visitor.visit(*this);
+	}
+
+	ScopeManager scope_manager;
+	std::vector<Frame> frames;
+	NativeSource native;
+
+	//Set by has_next, which has to run the generator until the next yield to know if there is one
+	std::shared_ptr<Value> buffered;
+
+	bool finished = false;
+	bool running = false;
+
+private:
+	MemoryCharge m_memory;
+};
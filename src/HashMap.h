@@ -0,0 +1,176 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <functional>
+#include <utility>
+
+/*
+* Open addressing hash map using Robin Hood probing.
+* Keys and values are stored inline in one flat slot array, the probe distances are kept
+* in a separate byte array so that probing only touches a small, densely packed buffer.
+* A probe distance of 0 marks an empty slot, otherwise it is the distance from the
+* home slot + 1. Erasing uses backward shifting so no tombstones are needed.
+*/
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class HashMap
+{
+public:
+	HashMap() = default;
+
+	inline size_t size() const { return m_size; }
+	inline size_t capacity() const { return m_slots.size(); }
+	inline size_t memory_usage() const { return m_slots.size() * (sizeof(Slot) + sizeof(uint8_t)); }
+
+	V* find(const K& key)
+	{
+		if (m_size == 0) return nullptr;
+
+		size_t mask = m_slots.size() - 1;
+		size_t index = Hash{}(key) & mask;
+		for (size_t dist = 1; dist <= m_dists[index]; ++dist)
+		{
+			if (m_dists[index] == dist && Eq{}(m_slots[index].key, key))
+				return &m_slots[index].value;
+			index = (index + 1) & mask;
+		}
+
+		return nullptr;
+	}
+
+	//Returns true if the key was inserted and false if an existing value was replaced
+	bool insert_or_assign(K key, V value)
+	{
+		if (V* existing = find(key))
+		{
+			*existing = std::move(value);
+			return false;
+		}
+
+		if ((m_size + 1) * 8 > m_slots.size() * 7)
+			grow();
+
+		Slot slot{ std::move(key), std::move(value) };
+		while (!place(slot))
+			grow();
+
+		++m_size;
+		return true;
+	}
+
+	bool erase(const K& key)
+	{
+		if (m_size == 0) return false;
+
+		size_t mask = m_slots.size() - 1;
+		size_t index = Hash{}(key) & mask;
+		for (size_t dist = 1; dist <= m_dists[index]; ++dist)
+		{
+			if (m_dists[index] == dist && Eq{}(m_slots[index].key, key))
+			{
+				//Shift the following entries back one step until we hit an empty slot or an entry in its home slot
+				size_t next = (index + 1) & mask;
+				while (m_dists[next] > 1)
+				{
+					m_slots[index] = std::move(m_slots[next]);
+					m_dists[index] = m_dists[next] - 1;
+					index = next;
+					next = (next + 1) & mask;
+				}
+				m_slots[index] = Slot{};
+				m_dists[index] = 0;
+				--m_size;
+				return true;
+			}
+			index = (index + 1) & mask;
+		}
+
+		return false;
+	}
+
+	void clear()
+	{
+		m_slots.clear();
+		m_dists.clear();
+		m_size = 0;
+	}
+
+	/*
+	* Iteration is done over slot indices. next_slot returns the first occupied slot
+	* at or after "from", or capacity() if there are no more entries.
+	*/
+	size_t next_slot(size_t from) const
+	{
+		while (from < m_dists.size() && m_dists[from] == 0)
+			++from;
+		return from < m_dists.size() ? from : capacity();
+	}
+
+	inline bool is_occupied(size_t slot) const { return slot < m_dists.size() && m_dists[slot] != 0; }
+	inline const K& key_at(size_t slot) const { return m_slots[slot].key; }
+	inline V& value_at(size_t slot) { return m_slots[slot].value; }
+	inline const V& value_at(size_t slot) const { return m_slots[slot].value; }
+
+private:
+	struct Slot
+	{
+		K key;
+		V value;
+	};
+
+	/*
+	* Returns false if the probe distance would overflow, in which case the table has to grow.
+	* On failure "slot" holds whichever entry was displaced last so that no entry is lost.
+	*/
+	bool place(Slot& slot)
+	{
+		size_t mask = m_slots.size() - 1;
+		size_t index = Hash{}(slot.key) & mask;
+		uint8_t dist = 1;
+		while (true)
+		{
+			if (m_dists[index] == 0)
+			{
+				m_slots[index] = std::move(slot);
+				m_dists[index] = dist;
+				return true;
+			}
+
+			//Robin Hood: steal the slot from entries that are closer to their home slot
+			if (m_dists[index] < dist)
+			{
+				std::swap(m_slots[index], slot);
+				std::swap(m_dists[index], dist);
+			}
+
+			if (dist == UINT8_MAX)
+				return false;
+
+			++dist;
+			index = (index + 1) & mask;
+		}
+	}
+
+	void grow()
+	{
+		std::vector<Slot> old_slots = std::move(m_slots);
+		std::vector<uint8_t> old_dists = std::move(m_dists);
+
+		size_t new_capacity = old_slots.empty() ? 8 : old_slots.size() * 2;
+		m_slots = std::vector<Slot>(new_capacity);
+		m_dists = std::vector<uint8_t>(new_capacity, 0);
+
+		for (size_t i = 0; i < old_slots.size(); ++i)
+		{
+			if (old_dists[i] == 0)
+				continue;
+
+			while (!place(old_slots[i]))
+				grow();
+		}
+	}
+
+	std::vector<Slot> m_slots;
+	std::vector<uint8_t> m_dists;
+	size_t m_size = 0;
+};
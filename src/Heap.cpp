@@ -0,0 +1,167 @@
+#include "Heap.h"
+#include "GeneratorValue.h"
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
+
+//Marks a value and queues the values it contains
+struct MarkVisitor : ValueVisitor
+{
+	using VisitResult = Result<std::shared_ptr<Value>, const char*>;
+
+	void mark(const Value* value)
+	{
+		if (value && marked.insert(value).second)
+			pending.push_back(value);
+	}
+
+	void mark_scopes(const ScopeManager& scope_manager)
+	{
+		for (const auto& scope : scope_manager.get_scopes())
+		{
+			for (const auto& variable : scope)
+				mark(variable.second.get());
+		}
+	}
+
+	void run()
+	{
+		while (!pending.empty())
+		{
+			const Value* value = pending.back();
+			pending.pop_back();
+			value->accept(*this);
+		}
+	}
+
+	VisitResult visit(const NumberValue<int>&) override { return {}; }
+	VisitResult visit(const NumberValue<float>&) override { return {}; }
+	VisitResult visit(const NumberValue<char>&) override { return {}; }
+	VisitResult visit(const StringValue&) override { return {}; }
+	VisitResult visit(const VoidValue&) override { return {}; }
+
+	VisitResult visit(const ReferenceValue& value) override
+	{
+		mark(value.get_variable_value().get());
+		return {};
+	}
+
+	VisitResult visit(const MapValue& value) override
+	{
+		for (size_t slot = value.entries.next_slot(0); slot < value.entries.capacity(); slot = value.entries.next_slot(slot + 1))
+			mark(value.entries.value_at(slot).get());
+		return {};
+	}
+
+	VisitResult visit(const RecordValue& value) override
+	{
+		for (const auto& slot : value.slots)
+			mark(slot.get());
+		return {};
+	}
+
+	VisitResult visit(const FutureValue& value) override
+	{
+		if (value.is_ready())
+		{
+			VisitResult result = value.get();
+			if (!result.is_error())
+				mark((*result).get());
+		}
+		return {};
+	}
+
+	VisitResult visit(const GeneratorValue& value) override
+	{
+		mark_scopes(value.scope_manager);
+		mark(value.buffered.get());
+		return {};
+	}
+
+	std::unordered_set<const Value*> marked;
+	std::vector<const Value*> pending;
+};
+
+//Drops the references held by an unreachable container
+static void clear_container(Value& value)
+{
+	if (auto* map = dynamic_cast<MapValue*>(&value))
+		map->entries.clear();
+	else if (auto* record = dynamic_cast<RecordValue*>(&value))
+	{
+		for (auto& slot : record->slots)
+			slot.reset();
+	}
+	else if (auto* generator = dynamic_cast<GeneratorValue*>(&value))
+	{
+		generator->frames.clear();
+		generator->native = nullptr;
+		generator->scope_manager = ScopeManager();
+		generator->buffered.reset();
+		generator->finished = true;
+	}
+}
+
+void Heap::track(const std::shared_ptr<Value>& value)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_objects.push_back(value);
+	if (m_objects.size() < m_threshold)
+		return;
+
+	//Most containers are freed by their reference counts, only collect if many of them are still alive
+	prune();
+	if (m_objects.size() * 2 >= m_threshold)
+	{
+		m_collect_requested = true;
+		m_threshold = m_objects.size() * 2;
+	}
+}
+
+void Heap::collect(const ScopeManager& roots)
+{
+	auto start = std::chrono::steady_clock::now();
+
+	MarkVisitor visitor;
+	visitor.mark_scopes(roots);
+	visitor.run();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	//Everything is cleared before anything is released so no container is freed while we iterate
+	std::vector<std::shared_ptr<Value>> unreachable;
+	for (const auto& object : m_objects)
+	{
+		std::shared_ptr<Value> value = object.lock();
+		if (value && visitor.marked.find(value.get()) == visitor.marked.end())
+			unreachable.push_back(std::move(value));
+	}
+	for (const auto& value : unreachable)
+		clear_container(*value);
+
+	m_stats.n_freed += unreachable.size();
+	unreachable.clear();
+	prune();
+
+	m_threshold = std::max<size_t>(4096, m_objects.size() * 2);
+	m_collect_requested = false;
+
+	double pause_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	++m_stats.n_collections;
+	m_stats.total_pause_ms += pause_ms;
+	m_stats.max_pause_ms = std::max(m_stats.max_pause_ms, pause_ms);
+}
+
+Heap::Stats Heap::get_stats() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+void Heap::prune()
+{
+	m_objects.erase(std::remove_if(m_objects.begin(), m_objects.end(),
+		[](const std::weak_ptr<Value>& object) { return object.expired(); }), m_objects.end());
+	m_stats.n_tracked = m_objects.size();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+#include "Value.h"
+#include "ScopeManager.h"
+
+/*
+* Cycle collector for the values which can contain other values (maps, records and generators).
+* Values are still owned by shared_ptrs which free everything that is not part of a cycle right away,
+* but a map stored in itself (or two records pointing at each other) would never be freed that way.
+* The heap keeps a weak pointer to every container, a collection marks everything reachable from the
+* scopes of the interpreter and clears the contents of the unreachable containers, which breaks the
+* cycles so the shared_ptrs can free them.
+*
+* Collections only run at safe points where no value can be held on the native stack (see
+* Interpreter::safe_point), containers are registered from any thread.
+*/
+class Heap
+{
+public:
+	struct Stats
+	{
+		size_t n_collections = 0;
+		size_t n_tracked = 0;  //Containers alive after the last collection or prune
+		size_t n_freed = 0;    //Containers freed by clearing cycles
+		double total_pause_ms = 0;
+		double max_pause_ms = 0;
+	};
+
+	void track(const std::shared_ptr<Value>& value);
+
+	//True once enough containers were allocated since the last collection
+	inline bool should_collect() const { return m_collect_requested.load(std::memory_order_relaxed); }
+
+	void collect(const ScopeManager& roots);
+
+	Stats get_stats() const;
+
+private:
+	//Drops the entries of containers which have already been freed, must hold m_mutex
+	void prune();
+
+	mutable std::mutex m_mutex;
+	std::vector<std::weak_ptr<Value>> m_objects;
+
+	//Collect when the number of tracked containers reaches the threshold, it grows with the live heap
+	size_t m_threshold = 4096;
+	std::atomic<bool> m_collect_requested{ false };
+
+	Stats m_stats;
+};
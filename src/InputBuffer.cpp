@@ -0,0 +1,90 @@
+#include "InputBuffer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+static constexpr size_t chunk_size = 1 << 20;
+
+InputBuffer::InputBuffer(bool batch)
+	: m_batch(batch)
+{
+	if (!m_batch)
+		return;
+
+	//A file redirected to stdin can be mapped, then there is nothing left to read
+	m_mapped = MappedFile::open_descriptor(0);
+	if (m_mapped)
+	{
+		long offset = std::ftell(stdin);
+		m_data = m_mapped->data();
+		m_pos = offset > 0 ? static_cast<size_t>(offset) : 0;
+		m_size = m_mapped->size();
+		m_eof = true;
+		return;
+	}
+
+	m_chunk.resize(chunk_size);
+	m_data = m_chunk.data();
+}
+
+InputBuffer::InputBuffer(std::string_view text)
+	: m_batch(true)
+	, m_chunk(text.begin(), text.end())
+{
+	m_data = m_chunk.data();
+	m_size = m_chunk.size();
+	m_eof = true;
+}
+
+bool InputBuffer::read_line(std::string& line)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (!m_batch)
+		return static_cast<bool>(std::getline(std::cin, line));
+
+	while (true)
+	{
+		const char* begin = m_data + m_pos;
+		const char* newline = m_pos < m_size ? static_cast<const char*>(std::memchr(begin, '\n', m_size - m_pos)) : nullptr;
+		if (newline || (m_eof && m_pos < m_size))
+		{
+			const char* end = newline ? newline : m_data + m_size;
+			m_pos = end - m_data + (newline ? 1 : 0);
+
+			//Lines ending in \r\n are returned without the \r like a text mode stream would
+			if (end != begin && end[-1] == '\r')
+				--end;
+			line.assign(begin, end);
+			return true;
+		}
+
+		if (m_eof || !fill())
+		{
+			line.clear();
+			return false;
+		}
+	}
+}
+
+bool InputBuffer::fill()
+{
+	//Move the start of the incomplete line to the front, the chunk only grows for lines longer than it
+	size_t remaining = m_size - m_pos;
+	std::memmove(m_chunk.data(), m_chunk.data() + m_pos, remaining);
+	m_pos = 0;
+	m_size = remaining;
+	if (m_size == m_chunk.size())
+		m_chunk.resize(m_chunk.size() * 2);
+	m_data = m_chunk.data();
+
+	size_t n_read = std::fread(m_chunk.data() + m_size, 1, m_chunk.size() - m_size, stdin);
+	m_size += n_read;
+	if (n_read == 0)
+	{
+		m_eof = true;
+		return m_pos < m_size;
+	}
+	return true;
+}
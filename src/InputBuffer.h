@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+#include "MappedFile.h"
+
+/*
+* Source of the lines returned by "input".
+* Interactive input reads stdin line by line. Batch input reads stdin in large blocks, or maps it
+* into memory when it is a regular file, and splits the lines out of that without going through iostreams.
+*/
+class InputBuffer
+{
+public:
+	explicit InputBuffer(bool batch);
+	//Returns the lines of "text" like batch input
+	explicit InputBuffer(std::string_view text);
+
+	InputBuffer(const InputBuffer&) = delete;
+	InputBuffer& operator=(const InputBuffer&) = delete;
+
+	inline bool is_batch() const { return m_batch; }
+
+	//Returns false with an empty line at the end of the input. Thread safe
+	bool read_line(std::string& line);
+
+private:
+	//Reads the next block of stdin behind the unread data, returns false at the end of the input
+	bool fill();
+
+	bool m_batch;
+
+	//The unread input is [m_data + m_pos, m_data + m_size), either the mapped file or m_chunk
+	const char* m_data = nullptr;
+	size_t m_pos = 0;
+	size_t m_size = 0;
+	bool m_eof = false;
+
+	std::vector<char> m_chunk;
+	std::shared_ptr<MappedFile> m_mapped;
+
+	std::mutex m_mutex;
+};
@@ -0,0 +1,128 @@
+#include "InstrumentedInterpreter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+void CountingHooks::call(const ASTCallNode& node)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	++m_calls[node.get_name()];
+}
+
+void CountingHooks::report(std::ostream& out) const
+{
+	out << "count: nodes";
+	for (size_t i = 0; i < m_nodes.size(); ++i)
+	{
+		uint64_t count = m_nodes[i].load(std::memory_order_relaxed);
+		if (count != 0)
+			out << ' ' << Stats::name(static_cast<Stats::Node>(i)) << ' ' << count;
+	}
+	out << '\n';
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<std::pair<std::string, uint64_t>> calls(m_calls.begin(), m_calls.end());
+	std::sort(calls.begin(), calls.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+	out << "count: calls";
+	for (const auto& [name, count] : calls)
+		out << ' ' << name << ' ' << count;
+	out << '\n';
+}
+
+//The depth of the traced calls running on this thread
+static thread_local size_t t_trace_depth = 0;
+
+void TracingHooks::call(const ASTCallNode& node)
+{
+	std::string line = "trace: " + std::string(2 * t_trace_depth++, ' ') + "> " + node.get_name() + "\n";
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::cerr << line;
+}
+
+void TracingHooks::ret(const ASTCallNode& node, const InterpreterResult& res)
+{
+	std::string line = "trace: " + std::string(2 * --t_trace_depth, ' ') + "< " + node.get_name();
+	if (res.is_error())
+		line += ": " + std::string(res.get_error());
+	line += "\n";
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::cerr << line;
+}
+
+struct TimingFrame
+{
+	std::chrono::steady_clock::time_point start;
+	uint64_t child_ns;
+};
+
+//The timed calls running on this thread and how many calls of each function are among them
+static thread_local std::vector<TimingFrame> t_timing_frames;
+static thread_local std::unordered_map<std::string_view, size_t> t_active_calls;
+
+void TimingHooks::call(const ASTCallNode& node)
+{
+	++t_active_calls[node.get_name()];
+	t_timing_frames.push_back({ std::chrono::steady_clock::now(), 0 });
+}
+
+void TimingHooks::ret(const ASTCallNode& node, const InterpreterResult&)
+{
+	TimingFrame frame = t_timing_frames.back();
+	t_timing_frames.pop_back();
+	uint64_t elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - frame.start).count();
+	if (!t_timing_frames.empty())
+		t_timing_frames.back().child_ns += elapsed_ns;
+	bool outermost = --t_active_calls[node.get_name()] == 0;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Function& function = m_functions[node.get_name()];
+	++function.n_calls;
+	function.self_ns += elapsed_ns - std::min(elapsed_ns, frame.child_ns);
+	if (outermost)
+		function.total_ns += elapsed_ns;
+}
+
+void TimingHooks::report(std::ostream& out) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::vector<std::pair<std::string, Function>> functions(m_functions.begin(), m_functions.end());
+	std::sort(functions.begin(), functions.end(), [](const auto& a, const auto& b) { return a.second.self_ns > b.second.self_ns; });
+
+	out << "time: " << std::setw(10) << "calls" << std::setw(12) << "self ms" << std::setw(12) << "total ms" << "  function" << '\n';
+	out << std::fixed << std::setprecision(3);
+	for (const auto& [name, function] : functions)
+	{
+		out << "time: " << std::setw(10) << function.n_calls << std::setw(12) << function.self_ns / 1e6
+			<< std::setw(12) << function.total_ns / 1e6 << "  " << name << '\n';
+	}
+	out << std::defaultfloat;
+}
+
+template <typename Hooks>
+class HookedInstrumentation : public Instrumentation
+{
+public:
+	std::unique_ptr<Interpreter> create_interpreter(OutputBuffer& output, InputBuffer& input, ThreadPool* pool, ModuleLoader* modules) override
+	{
+		return std::make_unique<InstrumentedInterpreter<Hooks>>(m_hooks, output, input, pool, modules);
+	}
+
+	void report(std::ostream& out) const override { m_hooks->report(out); }
+
+private:
+	std::shared_ptr<Hooks> m_hooks = std::make_shared<Hooks>();
+};
+
+std::unique_ptr<Instrumentation> Instrumentation::create(std::string_view name)
+{
+	if (name == "count")
+		return std::make_unique<HookedInstrumentation<CountingHooks>>();
+	if (name == "trace")
+		return std::make_unique<HookedInstrumentation<TracingHooks>>();
+	if (name == "time")
+		return std::make_unique<HookedInstrumentation<TimingHooks>>();
+	return nullptr;
+}
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "Interpreter.h"
+#include "Stats.h"
+
+/*
+* An interpreter which calls "Hooks" around every node it visits and every script call, for tracing and measuring
+* without touching the evaluator. Each visit is overridden to call the hooks around the visit of Interpreter, the
+* nodes visited inside reach the overrides again through the virtual visit of the visitor. The hooks are shared with
+* the workers so they have to be thread safe. A Hooks class implements
+*
+*	void enter(Stats::Node kind, const ASTNode& node);
+*	void exit(Stats::Node kind, const ASTNode& node, const InterpreterResult& res);
+*	void call(const ASTCallNode& node);
+*	void ret(const ASTCallNode& node, const InterpreterResult& res);
+*
+* Interpreter itself is the engine without hooks, it doesn't pay for the existence of the instrumented ones.
+* Variables read as operands are looked up without visiting them (see Interpreter::deref_expr), so they don't
+* reach the hooks, and neither do the calls made by builtins and by the host.
+*/
+template <typename Hooks>
+class InstrumentedInterpreter : public Interpreter
+{
+public:
+	InstrumentedInterpreter(std::shared_ptr<Hooks> hooks, OutputBuffer& output, InputBuffer& input, ThreadPool* pool = nullptr, ModuleLoader* modules = nullptr)
+		: Interpreter(output, input, pool, modules)
+		, m_hooks(std::move(hooks))
+	{}
+
+	InterpreterResult visit(const ASTLiteralNode& node) override { return hooked(Stats::Node::Literal, node); }
+	InterpreterResult visit(const ASTIdentifierNode& node) override { return hooked(Stats::Node::Identifier, node); }
+	InterpreterResult visit(const ASTUnaryNode& node) override { return hooked(Stats::Node::Unary, node); }
+	InterpreterResult visit(const ASTIfNode& node) override { return hooked(Stats::Node::If, node); }
+	InterpreterResult visit(const ASTWhileNode& node) override { return hooked(Stats::Node::While, node); }
+	InterpreterResult visit(const ASTPrintNode& node) override { return hooked(Stats::Node::Print, node); }
+	InterpreterResult visit(const ASTCastNode& node) override { return hooked(Stats::Node::Cast, node); }
+	InterpreterResult visit(const ASTInputNode& node) override { return hooked(Stats::Node::Input, node); }
+	InterpreterResult visit(const ASTBinaryNode& node) override { return hooked(Stats::Node::Binary, node); }
+	InterpreterResult visit(const ASTBlockNode& node) override { return hooked(Stats::Node::Block, node); }
+	InterpreterResult visit(const ASTLetNode& node) override { return hooked(Stats::Node::Let, node); }
+	InterpreterResult visit(const ASTAssignmentNode& node) override { return hooked(Stats::Node::Assignment, node); }
+	InterpreterResult visit(const ASTFunctionNode& node) override { return hooked(Stats::Node::Function, node); }
+	InterpreterResult visit(const ASTReturnNode& node) override { return hooked(Stats::Node::Return, node); }
+	InterpreterResult visit(const ASTStructNode& node) override { return hooked(Stats::Node::Struct, node); }
+	InterpreterResult visit(const ASTFieldNode& node) override { return hooked(Stats::Node::Field, node); }
+	InterpreterResult visit(const ASTFieldAssignmentNode& node) override { return hooked(Stats::Node::FieldAssignment, node); }
+	InterpreterResult visit(const ASTSpawnNode& node) override { return hooked(Stats::Node::Spawn, node); }
+	InterpreterResult visit(const ASTAwaitNode& node) override { return hooked(Stats::Node::Await, node); }
+	InterpreterResult visit(const ASTYieldNode& node) override { return hooked(Stats::Node::Yield, node); }
+	InterpreterResult visit(const ASTImportNode& node) override { return hooked(Stats::Node::Import, node); }
+
+	InterpreterResult visit(const ASTCallNode& node) override
+	{
+		m_hooks->enter(Stats::Node::Call, node);
+		m_hooks->call(node);
+		InterpreterResult res = Interpreter::visit(node);
+		m_hooks->ret(node, res);
+		m_hooks->exit(Stats::Node::Call, node, res);
+		return res;
+	}
+
+protected:
+	InstrumentedInterpreter(std::shared_ptr<Hooks> hooks, const InstrumentedInterpreter* parent)
+		: Interpreter(parent)
+		, m_hooks(std::move(hooks))
+	{}
+
+	std::unique_ptr<Interpreter> new_worker() const override
+	{
+		return std::unique_ptr<Interpreter>(new InstrumentedInterpreter(m_hooks, this));
+	}
+
+private:
+	template <typename Node>
+	inline InterpreterResult hooked(Stats::Node kind, const Node& node)
+	{
+		m_hooks->enter(kind, node);
+		InterpreterResult res = Interpreter::visit(node);
+		m_hooks->exit(kind, node, res);
+		return res;
+	}
+
+	std::shared_ptr<Hooks> m_hooks;
+};
+
+//Counts the visited nodes by kind and the calls by function
+class CountingHooks
+{
+public:
+	inline void enter(Stats::Node kind, const ASTNode&) { m_nodes[static_cast<size_t>(kind)].fetch_add(1, std::memory_order_relaxed); }
+	inline void exit(Stats::Node, const ASTNode&, const InterpreterResult&) {}
+	void call(const ASTCallNode& node);
+	inline void ret(const ASTCallNode&, const InterpreterResult&) {}
+
+	void report(std::ostream& out) const;
+
+private:
+	std::array<std::atomic<uint64_t>, static_cast<size_t>(Stats::Node::Count)> m_nodes{};
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, uint64_t> m_calls;
+};
+
+//Writes every call and return to stderr, indented by the depth of the call on its thread
+class TracingHooks
+{
+public:
+	inline void enter(Stats::Node, const ASTNode&) {}
+	inline void exit(Stats::Node, const ASTNode&, const InterpreterResult&) {}
+	void call(const ASTCallNode& node);
+	void ret(const ASTCallNode& node, const InterpreterResult& res);
+
+	inline void report(std::ostream&) const {}
+
+private:
+	std::mutex m_mutex;
+};
+
+/*
+* Measures the time of every call by function. The self time leaves out the calls made by the function, the total
+* time includes them but only counts the outermost of recursive calls.
+*/
+class TimingHooks
+{
+public:
+	inline void enter(Stats::Node, const ASTNode&) {}
+	inline void exit(Stats::Node, const ASTNode&, const InterpreterResult&) {}
+	void call(const ASTCallNode& node);
+	void ret(const ASTCallNode& node, const InterpreterResult& res);
+
+	void report(std::ostream& out) const;
+
+private:
+	struct Function
+	{
+		uint64_t n_calls = 0;
+		uint64_t self_ns = 0;
+		uint64_t total_ns = 0;
+	};
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Function> m_functions;
+};
+
+/*
+* The hooks chosen at startup (see --instrument), creates the interpreters which call them and reports what they
+* saw once the program is done.
+*/
+class Instrumentation
+{
+public:
+	virtual ~Instrumentation() = default;
+
+	//"count", "trace" or "time", nullptr for any other name
+	static std::unique_ptr<Instrumentation> create(std::string_view name);
+
+	virtual std::unique_ptr<Interpreter> create_interpreter(OutputBuffer& output, InputBuffer& input, ThreadPool* pool, ModuleLoader* modules) = 0;
+	virtual void report(std::ostream& out) const = 0;
+};
@@ -1,25 +1,157 @@
 #include "Interpreter.h"
+#include "ModuleLoader.h"
 #include "Value.h"
+#include <algorithm>
 #include <iostream>
 
-Interpreter::Interpreter()
+Interpreter::Interpreter(OutputBuffer& output, InputBuffer& input, ThreadPool* pool, ModuleLoader* modules)
+	: Interpreter(std::make_shared<Definitions>(), std::make_shared<Heap>(), output, input, pool)
+{
+	this->modules = modules;
+	register_builtins();
+}
+
+Interpreter::Interpreter(std::shared_ptr<Definitions> definitions, std::shared_ptr<Heap> heap, OutputBuffer& output, InputBuffer& input, ThreadPool* pool)
+	: heap(std::move(heap))
+	, pool(pool)
+	, output(output)
+	, input(input)
+	, definitions(std::move(definitions))
 {
 	//Add global scope
 	scope_manager.push_scope();
 }
 
+Interpreter::Interpreter(const Interpreter* parent)
+	: Interpreter(parent->definitions, parent->heap, parent->output, parent->input, parent->pool)
+{
+	is_worker = true;
+	n_running_tasks = parent->n_running_tasks;
+}
+
+std::unique_ptr<Interpreter> Interpreter::new_worker() const
+{
+	return std::unique_ptr<Interpreter>(new Interpreter(this));
+}
+
+std::unique_ptr<Interpreter> Interpreter::create_worker() const
+{
+	std::unique_ptr<Interpreter> worker = new_worker();
+	worker->max_depth = max_depth;
+	if (budget)
+		worker->attach_budget(budget);
+	//The samples of a worker continue the stack which started it
+	if (profiler)
+		worker->attach_profiler(profiler, profile_stack);
+	for (const auto& variable : scope_manager.get_global_scope())
+		worker->scope_manager.add_variable(variable.first, variable.second);
+	return worker;
+}
+
+size_t Interpreter::stack_size(size_t max_depth)
+{
+	//A call takes about 1 KB of stack in optimized and unoptimized builds, the rest is left for nested expressions
+	return max_depth * 2048 + 1024 * 1024;
+}
+
+void Interpreter::set_limits(const Budget::Limits& limits)
+{
+	if (limits.max_steps == 0 && limits.max_milliseconds == 0 && limits.max_memory == 0)
+		attach_budget(nullptr);
+	else
+		attach_budget(std::make_shared<Budget>(limits));
+}
+
+void Interpreter::set_profiler(std::shared_ptr<Profiler> profiler)
+{
+	attach_profiler(std::move(profiler), {});
+}
+
+void Interpreter::attach_budget(std::shared_ptr<Budget> budget)
+{
+	this->budget = std::move(budget);
+	uncharged_steps = 0;
+	if (this->budget)
+		this->budget->charge(0, budget_chunk);
+	start_countdown();
+}
+
+void Interpreter::attach_profiler(std::shared_ptr<Profiler> profiler, const Profiler::Stack& stack)
+{
+	this->profiler = std::move(profiler);
+	profile_stack = this->profiler ? stack : Profiler::Stack();
+	if (this->profiler)
+		next_sample = this->profiler->first_sample();
+	start_countdown();
+}
+
+void Interpreter::start_countdown()
+{
+	uint64_t chunk = UINT64_MAX;
+	//Once the budget is exceeded every following step fails
+	if (budget)
+		chunk = budget->get_error() ? 1 : budget_chunk - uncharged_steps;
+	if (profiler)
+		chunk = std::min(chunk, Profiler::steps_per_check);
+	step_chunk = chunk;
+	steps_until_check = chunk;
+}
+
+const char* Interpreter::check_point()
+{
+	uncharged_steps += step_chunk;
+	if (profiler)
+		profiler->sample(profile_stack, next_sample);
+
+	const char* error = nullptr;
+	if (budget && (uncharged_steps >= budget_chunk || budget->get_error()))
+	{
+		error = budget->charge(uncharged_steps, budget_chunk);
+		uncharged_steps = 0;
+	}
+	start_countdown();
+	return error;
+}
+
+Interpreter::Definitions& Interpreter::definitions_for_write()
+{
+	if (definitions.use_count() > 1)
+		definitions = std::make_shared<Definitions>(*definitions);
+	return *definitions;
+}
+
 InterpreterResult Interpreter::interpret(const ASTNode& node)
 {
-	return node.accept(*this);
+	MemoryAccount::Scope memory = account_memory();
+	InterpreterResult res = node.accept(*this);
+	safe_point();
+	return res;
+}
+
+void Interpreter::safe_point()
+{
+	//Workers, function calls and generators can have values on the native stack which the heap doesn't know about
+	if (is_worker || runtime_data.n_function_calls != 0 || runtime_data.n_running_generators != 0)
+		return;
+	if (!heap->should_collect())
+		return;
+
+	//Tasks that are still queued or running hold values which are not reachable from our scopes
+	if (has_running_tasks())
+		return;
+
+	heap->collect(scope_manager);
 }
 
 InterpreterResult Interpreter::visit(const ASTLiteralNode& node)
 {
+	STATS_NODE(Literal);
 	return node.get_value();
 }
 
 InterpreterResult Interpreter::visit(const ASTIdentifierNode& node)
 {
+	STATS_NODE(Identifier);
 	if (const auto& variable = scope_manager.get_variable(node.get_name()))
 		return { std::make_shared<ReferenceValue>(variable) };
 	return "Symbol does not exist error";
@@ -27,7 +159,8 @@ InterpreterResult Interpreter::visit(const ASTIdentifierNode& node)
 
 InterpreterResult Interpreter::visit(const ASTUnaryNode& node)
 {
-	InterpreterResult operand_res = node.get_operand()->accept(*this);
+	STATS_NODE(Unary);
+	InterpreterResult operand_res = deref_expr(node.get_operand().get());
 	if (operand_res.is_error()) 
 		return operand_res;
 
@@ -39,7 +172,8 @@ InterpreterResult Interpreter::visit(const ASTUnaryNode& node)
 
 InterpreterResult Interpreter::visit(const ASTIfNode& node)
 {
-	InterpreterResult condition_res = node.get_conditon()->accept(*this);
+	STATS_NODE(If);
+	InterpreterResult condition_res = deref_expr(node.get_conditon().get());
 	if (condition_res.is_error())
 		return condition_res;
 
@@ -59,7 +193,19 @@ InterpreterResult Interpreter::visit(const ASTIfNode& node)
 
 InterpreterResult Interpreter::visit(const ASTWhileNode& node)
 {
-	InterpreterResult condition_res = node.get_conditon()->accept(*this);
+	STATS_NODE(While);
+	if (!profiler)
+		return run_loop(node);
+
+	profile_stack.push_back(&node);
+	InterpreterResult res = run_loop(node);
+	profile_stack.pop_back();
+	return res;
+}
+
+InterpreterResult Interpreter::run_loop(const ASTWhileNode& node)
+{
+	InterpreterResult condition_res = deref_expr(node.get_conditon().get());
 	if (condition_res.is_error())
 		return condition_res;
 
@@ -67,10 +213,16 @@ InterpreterResult Interpreter::visit(const ASTWhileNode& node)
 	while (cond_expr->is_truthy())
 	{
 		InterpreterResult stmt_res = node.get_then_stmt()->accept(*this);
-		if (stmt_res.is_error())
+		if (stmt_res.is_error() || return_value)
 			return stmt_res;
 
-		InterpreterResult condition_res = node.get_conditon()->accept(*this);
+		if (const char* error = take_step())
+			return error;
+
+		//Loops at the top level may never return to the caller of interpret, so they need their own safe point
+		safe_point();
+
+		InterpreterResult condition_res = deref_expr(node.get_conditon().get());
 		if (condition_res.is_error())
 			return condition_res;
 
@@ -82,19 +234,29 @@ InterpreterResult Interpreter::visit(const ASTWhileNode& node)
 
 InterpreterResult Interpreter::visit(const ASTPrintNode& node)
 {
-	InterpreterResult expr_res = node.get_expr()->accept(*this);
+	STATS_NODE(Print);
+	InterpreterResult expr_res = deref_expr(node.get_expr().get());
 	if (expr_res.is_error())
 		return expr_res;
 
 	Value* value = (*expr_res).get();
 
-	PrintVisitor visitor;
-	return value->accept(visitor);
+	//The line is built first and written as a whole, the buffer is reused between prints
+	print_line.assign(">> ");
+	PrintVisitor visitor(print_line);
+	InterpreterResult print_res = value->accept(visitor);
+	if (print_res.is_error())
+		return print_res;
+
+	print_line.push_back('\n');
+	output.write(print_line);
+	return {};
 }
 
 InterpreterResult Interpreter::visit(const ASTCastNode& node)
 {
-	InterpreterResult expr_res = node.get_expr()->accept(*this);
+	STATS_NODE(Cast);
+	InterpreterResult expr_res = deref_expr(node.get_expr().get());
 	if (expr_res.is_error())
 		return expr_res;
 	
@@ -105,19 +267,26 @@ InterpreterResult Interpreter::visit(const ASTCastNode& node)
 
 InterpreterResult Interpreter::visit(const ASTInputNode&)
 {
-	std::string input;
-	std::cout << "Input: ";
-	std::getline(std::cin, input);
+	STATS_NODE(Input);
+	//The prompt has to be visible before we block, batch input has no prompt
+	if (!input.is_batch())
+	{
+		output.write("Input: ");
+		output.flush();
+	}
 
-	return { std::make_shared<StringValue>(input) };
+	std::string line;
+	input.read_line(line);
+	return { std::make_shared<StringValue>(std::move(line)) };
 }
 
 InterpreterResult Interpreter::visit(const ASTBinaryNode& node)
 {
-	InterpreterResult lhs_res = node.get_lhs()->accept(*this);
+	STATS_NODE(Binary);
+	InterpreterResult lhs_res = deref_expr(node.get_lhs().get());
 	if (lhs_res.is_error()) return lhs_res.get_error();
 
-	InterpreterResult rhs_res = node.get_rhs()->accept(*this);
+	InterpreterResult rhs_res = deref_expr(node.get_rhs().get());
 	if (rhs_res.is_error()) return rhs_res.get_error();
 
 	Value* lhs = (*lhs_res).get();
@@ -129,20 +298,17 @@ InterpreterResult Interpreter::visit(const ASTBinaryNode& node)
 
 InterpreterResult Interpreter::visit(const ASTBlockNode& node)
 {
+	STATS_NODE(Block);
 	scope_manager.push_scope();
 	for (const auto& stmt : node.get_stmts())
 	{
-		try
-		{
-			InterpreterResult stmt_res = stmt->accept(*this);
-			if (stmt_res.is_error())
-				return stmt_res;
-		}
-		catch (const std::shared_ptr<Value>& returned)
+		InterpreterResult stmt_res = stmt->accept(*this);
+
+		//If we return we have to pop this blocks scope before continuing with the return
+		if (stmt_res.is_error() || return_value)
 		{
-			//If we return we have to pop this blocks scope before continuing with the return
 			scope_manager.pop_scope();
-			throw returned;
+			return stmt_res;
 		}
 	}
 	scope_manager.pop_scope();
@@ -152,28 +318,41 @@ InterpreterResult Interpreter::visit(const ASTBlockNode& node)
 
 InterpreterResult Interpreter::deref_expr(ASTNode* expr)
 {
+	//This runs for almost every expression, the classes are final so comparing typeids is enough and much cheaper than dynamic_cast
+
+	//Reading a variable doesn't need the reference that visiting the identifier would allocate
+	if (typeid(*expr) == typeid(ASTIdentifierNode))
+	{
+		STATS_NODE(Identifier);
+		if (const auto& variable = scope_manager.get_variable(static_cast<ASTIdentifierNode*>(expr)->get_name()))
+			return *variable;
+		return "Symbol does not exist error";
+	}
+
 	InterpreterResult expr_res = expr->accept(*this);
 	if (expr_res.is_error())
 		return expr_res;
 
-	std::shared_ptr<Value> deref = *expr_res;
-	if (const auto& ref = dynamic_cast<ReferenceValue*>(deref.get()))
-		deref = ref->get_variable_value();
+	if (typeid(**expr_res) == typeid(ReferenceValue))
+		return static_cast<ReferenceValue*>((*expr_res).get())->get_variable_value();
 
-	return deref;
+	return expr_res;
 }
 
 InterpreterResult Interpreter::visit(const ASTLetNode& node)
 {
+	STATS_NODE(Let);
 	//If the variable is set to a reference we want to dereference it 
 	InterpreterResult deref_res = deref_expr(node.get_expr().get());
 	if (deref_res.is_error())
 		return deref_res;
 	scope_manager.add_variable(node.get_var_name(), *deref_res);
+	return {};
 }
 
 InterpreterResult Interpreter::visit(const ASTAssignmentNode& node)
 {
+	STATS_NODE(Assignment);
 	InterpreterResult literal_res = visit(*node.get_variable().get());
 	if (literal_res.is_error())
 		return literal_res;
@@ -195,86 +374,476 @@ InterpreterResult Interpreter::visit(const ASTAssignmentNode& node)
 
 InterpreterResult Interpreter::visit(const ASTFunctionNode& node)
 {
-	function_table[node.get_name()] = { node.get_block().get(), &node.get_args()};
+	STATS_NODE(Function);
+	definitions_for_write().function_table[node.get_name()] = { &node, &node.get_args(), node.is_generator() };
 	return {};
 }
 
 InterpreterResult Interpreter::visit(const ASTCallNode& node)
 {
-	if(function_table.find(node.get_name()) != function_table.end()) 
-	{
-		++runtime_data.n_function_calls;
+	STATS_NODE(Call);
+	const std::string& name = node.get_name();
+
+	//Script functions are the common case, the other tables are only searched when the name isn't one
+	size_t n_args = 0;
+	auto function_it = definitions->function_table.find(name);
+	auto struct_it = definitions->struct_table.end();
+	auto builtin_it = definitions->builtin_table.end();
+	if (function_it != definitions->function_table.end())
+		n_args = function_it->second.arg_names->size();
+	else if ((struct_it = definitions->struct_table.find(name)) != definitions->struct_table.end())
+		n_args = struct_it->second->get_fields().size();
+	else if ((builtin_it = definitions->builtin_table.find(name)) != definitions->builtin_table.end())
+		n_args = builtin_it->second.n_args;
+	else
+		return "Function does not exist";
 
-		Function func = function_table.at(node.get_name());
+	if (n_args != node.get_args().size())
+		return "Incorrect number of arguments in function call";
 
-		if (func.arg_names->size() != node.get_args().size())
-			return "Incorrect number of arguments in function call";
+	std::vector<std::shared_ptr<Value>> args_values;
+	InterpreterResult args_res = evaluate_args(node, args_values);
+	if (args_res.is_error())
+		return args_res;
 
-		//Place arguments in their own scope
-		scope_manager.push_scope();
+	if (function_it != definitions->function_table.end())
+		return call_function(function_it->second, args_values);
 
-		// We have to evaluate all arguments before initializing them
-		// Otherwise values depening on each other such as in fn foo(x, y) {...};
-		// foo(x+1, x) would become -> foo(x+1, x+1+1) since x will have the new value 
-		// x+1 before evauating the second argument
-		std::vector<std::shared_ptr<Value>> args_values;
-		for(size_t i = 0; i < func.arg_names->size(); ++i) 
-		{
-			//Similar to let, we don't want references here
-			InterpreterResult deref_res = deref_expr(node.get_args().at(i).get());
-			if (deref_res.is_error())
-				return deref_res;
-			args_values.push_back(*deref_res);
-		}
+	//Fields are initialized in declaration order
+	if (struct_it != definitions->struct_table.end())
+		return { allocate<RecordValue>(struct_it->second, std::move(args_values)) };
 
-		for (size_t i = 0; i < func.arg_names->size(); ++i)
-		{
-			scope_manager.add_variable(func.arg_names->at(i), args_values.at(i));
-		}
+	STATS_BUILTIN_CALL();
+	return builtin_it->second.fn(*this, args_values);
+}
 
-		std::shared_ptr<Value> return_val;
-		try
-		{
-			InterpreterResult res = visit(*func.body);
-			if (res.is_error())
-				return res;
-			return_val = void_val;
-		}
-		catch (const std::shared_ptr<Value>& returned)
-		{
-			return_val = returned;
+std::optional<Interpreter::Function> Interpreter::find_function(const std::string& name) const
+{
+	auto function_it = definitions->function_table.find(name);
+	if (function_it == definitions->function_table.end())
+		return std::nullopt;
+	return function_it->second;
+}
 
-			//Don't want to return references
-			if (const auto& ref = dynamic_cast<ReferenceValue*>(return_val.get()))
-				return_val = ref->get_variable_value();
-		}
+InterpreterResult Interpreter::call(const Function& func, const std::vector<std::shared_ptr<Value>>& args_values)
+{
+	if (func.arg_names->size() != args_values.size())
+		return "Incorrect number of arguments in function call";
+	MemoryAccount::Scope memory = account_memory();
+	return call_function(func, args_values);
+}
+
+void Interpreter::register_native(const std::string& name, size_t n_args, NativeFunction fn)
+{
+	definitions_for_write().builtin_table[name] = { n_args, std::move(fn) };
+}
+
+InterpreterResult Interpreter::evaluate_args(const ASTCallNode& node, std::vector<std::shared_ptr<Value>>& args_values)
+{
+	// We have to evaluate all arguments before initializing them
+	// Otherwise values depening on each other such as in fn foo(x, y) {...};
+	// foo(x+1, x) would become -> foo(x+1, x+1+1) since x will have the new value 
+	// x+1 before evauating the second argument
+	args_values.reserve(node.get_args().size());
+	for (const auto& arg : node.get_args())
+	{
+		//Similar to let, we don't want references here
+		InterpreterResult deref_res = deref_expr(arg.get());
+		if (deref_res.is_error())
+			return deref_res;
+		args_values.push_back(*deref_res);
+	}
+
+	return {};
+}
+
+InterpreterResult Interpreter::call_function(const Function& func, const std::vector<std::shared_ptr<Value>>& args_values)
+{
+	//Lazily parsed functions report syntax errors in their body when they are called
+	auto body = func.node->get_body();
+	if (body.is_error())
+		return body.get_error();
 
-		--runtime_data.n_function_calls;
-		scope_manager.pop_scope();
+	//The body of a generator only runs when the generator is resumed
+	if (func.is_generator)
+	{
+		auto generator = allocate<GeneratorValue>(*body);
+		for (size_t i = 0; i < func.arg_names->size(); ++i)
+			generator->scope_manager.add_variable(func.arg_names->at(i), args_values.at(i));
+		return { generator };
+	}
 
-		return return_val;
+	if (depth_exceeded())
+		return "Stack overflow";
+	if (const char* error = take_step())
+		return error;
+
+	++runtime_data.n_function_calls;
+	STATS_CALL(runtime_data.n_function_calls);
+
+	//Place arguments in their own scope
+	scope_manager.push_scope();
+	for (size_t i = 0; i < func.arg_names->size(); ++i)
+	{
+		scope_manager.add_variable(func.arg_names->at(i), args_values.at(i));
 	}
 
-	return "Function does not exist";
+	if (profiler)
+		profile_stack.push_back(func.node);
+	InterpreterResult res = visit(**body);
+	if (profiler)
+		profile_stack.pop_back();
+	--runtime_data.n_function_calls;
+	scope_manager.pop_scope();
+	if (res.is_error())
+		return res;
+
+	//Falling off the end of the body returns void
+	if (!return_value)
+		return { void_val };
+	return { std::move(return_value) };
 }
 
 InterpreterResult Interpreter::visit(const ASTReturnNode& node)
 {
+	STATS_NODE(Return);
 	if (runtime_data.n_function_calls == 0)
 		return "Cannot return outside function";
 
 	if(node.get_expr()) 
 	{
-		InterpreterResult expr_res = node.get_expr()->accept(*this);
+		//Dereference before unwinding, the scopes of the variable might be popped on the way out
+		InterpreterResult expr_res = deref_expr(node.get_expr().get());
 		if (expr_res.is_error())
 			return expr_res;
 
-		throw *expr_res;
+		return_value = *expr_res;
 	}
+	else
+		return_value = void_val;
 
-	throw static_cast<std::shared_ptr<Value>>(void_val);
-	
-	return {}; //Won't reach this line but it's fine to keep it for consistency
+	return {};
+}
+
+InterpreterResult Interpreter::visit(const ASTStructNode& node)
+{
+	STATS_NODE(Struct);
+	definitions_for_write().struct_table[node.get_layout()->get_name()] = node.get_layout();
+	return {};
+}
+
+InterpreterResult Interpreter::visit(const ASTImportNode& node)
+{
+	STATS_NODE(Import);
+	if (!modules || !pool)
+		return "Imports are not supported here";
+
+	auto module_res = modules->load(node.get_path(), module_directory, *pool);
+	if (module_res.is_error())
+		return module_res.get_error();
+
+	//Nothing to do if the module was imported before
+	const ModuleLoader::Module* module = *module_res;
+	if (!module)
+		return {};
+
+	if (profiler)
+		profiler->add_source(module->name_space + ".", module->source->view());
+
+	//Large libraries would otherwise rehash the function table many times
+	Definitions& write_definitions = definitions_for_write();
+	write_definitions.function_table.reserve(write_definitions.function_table.size() + module->declarations.size());
+
+	std::string importer_directory = std::move(module_directory);
+	module_directory = module->directory;
+	const char* error = nullptr;
+	for (const auto& declaration : module->declarations)
+	{
+		InterpreterResult res = declaration->accept(*this);
+		if (res.is_error())
+		{
+			error = res.get_error();
+			break;
+		}
+	}
+	module_directory = std::move(importer_directory);
+
+	if (error)
+		return error;
+	return {};
+}
+
+InterpreterResult Interpreter::visit(const ASTFieldNode& node)
+{
+	STATS_NODE(Field);
+	InterpreterResult object_res = deref_expr(node.get_object().get());
+	if (object_res.is_error())
+		return object_res;
+
+	std::shared_ptr<Value> object = *object_res;
+	auto* record = dynamic_cast<RecordValue*>(object.get());
+	if (!record)
+		return "Field access on value which is not a record";
+
+	size_t slot = node.resolve_slot(record->layout.get());
+	if (slot == StructLayout::npos)
+		return "Record has no such field";
+
+	//The reference keeps the record alive in case it is a temporary
+	return { std::make_shared<ReferenceValue>(&record->slots[slot], object) };
+}
+
+InterpreterResult Interpreter::visit(const ASTFieldAssignmentNode& node)
+{
+	STATS_NODE(FieldAssignment);
+	//The value is evaluated first so that the record can't be replaced while we hold a reference into it
+	InterpreterResult expr_res = deref_expr(node.get_expr().get());
+	if (expr_res.is_error())
+		return expr_res;
+
+	InterpreterResult field_res = visit(*node.get_field().get());
+	if (field_res.is_error())
+		return field_res;
+
+	//Field node visit always returns reference
+	static_cast<ReferenceValue*>((*field_res).get())->set_variable_value(*expr_res);
+
+	return {};
+}
+
+InterpreterResult Interpreter::visit(const ASTSpawnNode& node)
+{
+	STATS_NODE(Spawn);
+	const ASTCallNode& call = *node.get_call();
+
+	auto function_it = definitions->function_table.find(call.get_name());
+	if (function_it == definitions->function_table.end())
+		return "Only user defined functions can be spawned";
+	if (function_it->second.arg_names->size() != call.get_args().size())
+		return "Incorrect number of arguments in function call";
+
+	//Arguments are evaluated right away on this thread, only the call itself is deferred
+	std::vector<std::shared_ptr<Value>> args_values;
+	InterpreterResult args_res = evaluate_args(call, args_values);
+	if (args_res.is_error())
+		return args_res;
+
+	auto future = std::make_shared<FutureValue>();
+	std::shared_ptr<Interpreter> worker = create_worker();
+	Function func = function_it->second;
+	auto task = [worker, func, args_values, future, n_running_tasks = n_running_tasks]() mutable
+	{
+		{
+			MemoryAccount::Scope memory = worker->account_memory();
+			future->complete(worker->call_function(func, args_values));
+		}
+
+		//Whoever waits for the tasks may destroy what the worker and the arguments reference once the count drops
+		worker.reset();
+		args_values.clear();
+		--*n_running_tasks;
+	};
+
+	++*n_running_tasks;
+
+	//Without worker threads nobody else would run the task so it runs here
+	if (pool && pool->get_thread_count() > 1)
+		pool->submit(task);
+	else
+		task();
+
+	return { future };
+}
+
+InterpreterResult Interpreter::visit(const ASTAwaitNode& node)
+{
+	STATS_NODE(Await);
+	InterpreterResult expr_res = deref_expr(node.get_expr().get());
+	if (expr_res.is_error())
+		return expr_res;
+
+	auto* future = dynamic_cast<FutureValue*>((*expr_res).get());
+	if (!future)
+		return "Value is not a future";
+
+	//Run other tasks while waiting, the task we wait for might be queued behind them
+	while (!future->is_ready())
+	{
+		if (!pool || !pool->try_run_one())
+			future->wait_for(std::chrono::milliseconds(1));
+	}
+
+	return future->get();
+}
+
+InterpreterResult Interpreter::visit(const ASTYieldNode&)
+{
+	STATS_NODE(Yield);
+	//Yields inside generators are handled by step_generator, so this is only reached outside of them
+	return "Cannot yield outside generator";
+}
+
+InterpreterResult Interpreter::resume_generator(GeneratorValue& generator)
+{
+	if (generator.finished)
+		return { void_val };
+	if (generator.running)
+		return "Generator is already running";
+
+	if (depth_exceeded())
+		return "Stack overflow";
+
+	if (generator.native)
+	{
+		if (std::shared_ptr<Value> value = generator.native())
+			return { value };
+
+		generator.finished = true;
+		generator.native = nullptr;
+		return { void_val };
+	}
+
+	//The body runs in the scopes of the generator, resuming another generator from inside nests the swaps
+	//The globals stay visible through the link, they don't move while the scopes they belong to are swapped out
+	generator.running = true;
+	++runtime_data.n_running_generators;
+	generator.scope_manager.link_globals(&scope_manager.get_globals());
+	std::swap(scope_manager, generator.scope_manager);
+	InterpreterResult result = step_generator(generator);
+	std::swap(scope_manager, generator.scope_manager);
+	generator.scope_manager.link_globals(nullptr);
+	--runtime_data.n_running_generators;
+	generator.running = false;
+
+	if (generator.finished)
+	{
+		//Release the variables, a finished generator is never resumed again
+		generator.frames.clear();
+		generator.scope_manager = ScopeManager();
+	}
+
+	return result;
+}
+
+/*
+* Executes the body of a generator one statement at a time using the explicit frame stack of the
+* generator instead of recursing through the blocks, ifs and whiles of the body. Other statements
+* and all expressions are evaluated as usual. Returning keeps the frames so the next resume continues
+* right after the yield.
+*/
+InterpreterResult Interpreter::step_generator(GeneratorValue& generator)
+{
+	std::vector<GeneratorValue::Frame>& frames = generator.frames;
+	while (!frames.empty())
+	{
+		GeneratorValue::Frame& frame = frames.back();
+		const ASTNode* node = frame.node;
+
+		if (const auto* block = dynamic_cast<const ASTBlockNode*>(node))
+		{
+			if (frame.pc == 0)
+				scope_manager.push_scope();
+
+			if (frame.pc < block->get_stmts().size())
+			{
+				const ASTNode* stmt = block->get_stmts()[frame.pc++].get();
+				frames.push_back({ stmt, 0 });
+			}
+			else
+			{
+				scope_manager.pop_scope();
+				frames.pop_back();
+			}
+			continue;
+		}
+
+		if (const auto* if_node = dynamic_cast<const ASTIfNode*>(node))
+		{
+			if (frame.pc == 1)
+			{
+				frames.pop_back();
+				continue;
+			}
+
+			InterpreterResult condition_res = deref_expr(if_node->get_conditon().get());
+			if (condition_res.is_error())
+			{
+				generator.finished = true;
+				return condition_res;
+			}
+
+			const ASTNode* branch = (*condition_res)->is_truthy() ? if_node->get_then_stmt().get() : if_node->get_else_stmt().get();
+			frame.pc = 1;
+			if (branch)
+				frames.push_back({ branch, 0 });
+			continue;
+		}
+
+		if (const auto* while_node = dynamic_cast<const ASTWhileNode*>(node))
+		{
+			//The condition is evaluated again every time the body frame has been popped
+			InterpreterResult condition_res = deref_expr(while_node->get_conditon().get());
+			if (condition_res.is_error())
+			{
+				generator.finished = true;
+				return condition_res;
+			}
+
+			if ((*condition_res)->is_truthy())
+			{
+				if (const char* error = take_step())
+				{
+					generator.finished = true;
+					return error;
+				}
+				frames.push_back({ while_node->get_then_stmt().get(), 0 });
+			}
+			else
+				frames.pop_back();
+			continue;
+		}
+
+		if (const auto* yield_node = dynamic_cast<const ASTYieldNode*>(node))
+		{
+			frames.pop_back();
+
+			InterpreterResult yield_res = deref_expr(yield_node->get_expr().get());
+			if (yield_res.is_error())
+				generator.finished = true;
+			else if (dynamic_cast<VoidValue*>((*yield_res).get()))
+			{
+				generator.finished = true;
+				return "Value is void";
+			}
+			return yield_res;
+		}
+
+		if (const auto* return_node = dynamic_cast<const ASTReturnNode*>(node))
+		{
+			//The returned value is evaluated for its side effects but a generator only produces yielded values
+			if (return_node->get_expr())
+			{
+				InterpreterResult return_res = return_node->get_expr()->accept(*this);
+				if (return_res.is_error())
+				{
+					generator.finished = true;
+					return return_res;
+				}
+			}
+			break;
+		}
+
+		frames.pop_back();
+		InterpreterResult stmt_res = node->accept(*this);
+		if (stmt_res.is_error())
+		{
+			generator.finished = true;
+			return stmt_res;
+		}
+	}
+
+	generator.finished = true;
+	return { void_val };
 }
 
 /*
@@ -335,6 +904,50 @@ InterpreterResult Interpreter::PrintVisitor::visit(const StringValue& value)
 	return print(value.text);
 }
 
+InterpreterResult Interpreter::PrintVisitor::visit(const MapValue& value)
+{
+	out.push_back('{');
+
+	bool first = true;
+	for (size_t slot = value.entries.next_slot(0); slot < value.entries.capacity(); slot = value.entries.next_slot(slot + 1))
+	{
+		if (!first)
+			out.append(", ");
+		first = false;
+
+		MapValue::from_key(value.entries.key_at(slot))->accept(*this);
+		out.append(": ");
+		InterpreterResult entry_res = value.entries.value_at(slot)->accept(*this);
+		if (entry_res.is_error())
+			return entry_res;
+	}
+
+	out.push_back('}');
+	return {};
+}
+
+InterpreterResult Interpreter::PrintVisitor::visit(const RecordValue& value)
+{
+	out.append(value.layout->get_name());
+	out.push_back('{');
+
+	const std::vector<std::string>& fields = value.layout->get_fields();
+	for (size_t i = 0; i < fields.size(); ++i)
+	{
+		if (i != 0)
+			out.append(", ");
+
+		out.append(fields[i]);
+		out.append(": ");
+		InterpreterResult field_res = value.slots[i]->accept(*this);
+		if (field_res.is_error())
+			return field_res;
+	}
+
+	out.push_back('}');
+	return {};
+}
+
 /*
  * CAST
 */
@@ -377,11 +990,11 @@ InterpreterResult Interpreter::CastVisitor::visit(const NumberValue<char>& value
 InterpreterResult Interpreter::CastVisitor::visit(const StringValue& value)
 {
 	if (type == Type::INT)
-		return str_to_num<int>(value.text, [](const std::string& str) { return std::stoi(str); });
+		return str_to_num<int>(std::string(value.text), [](const std::string& str) { return std::stoi(str); });
 	if (type == Type::FLOAT)
-		return str_to_num<float>(value.text, [](const std::string& str) { return std::stof(str); });
+		return str_to_num<float>(std::string(value.text), [](const std::string& str) { return std::stof(str); });
 	if (type == Type::STRING)
-		return { std::make_shared<StringValue>(value.text) };
+		return { std::make_shared<StringValue>(std::string(value.text)) };
 
 	return "Cannot convert string to x";
 }
@@ -420,12 +1033,13 @@ InterpreterResult Interpreter::BinaryOperationVisitor::visit(const StringValue&
 		switch (op)
 		{
 		case Operator::PLUS:
-			return { std::make_shared<StringValue>(value.text + other_val->text) };
+			STATS_CONCATENATION(value.text.size() + other_val->text.size());
+			return { std::make_shared<StringValue>(std::string(value.text).append(other_val->text)) };
 		case Operator::EQUALS:
 			return { std::make_shared<NumberValue<int>>(value.text == other_val->text) };
+		default:
+			return "Binary operator is not supported on string";
 		}
-
-		return "Binary operator is not supported on string";
 	}
 
 	return "Types are not compatible in binary operation";
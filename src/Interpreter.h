@@ -1,23 +1,87 @@
 #pragma once
 
+#include <atomic>
 #include <unordered_map>
 #include <string>
 #include <functional>
+#include <optional>
+#include <typeinfo>
 
 #include "ASTVisitor.h"
 #include "AST.h"
 #include "ScopeManager.h"
+#include "ThreadPool.h"
 #include "Value.h"
+#include "GeneratorValue.h"
+#include "Budget.h"
+#include "Heap.h"
+#include "Profiler.h"
+#include "StackThread.h"
+#include "OutputBuffer.h"
+#include "InputBuffer.h"
+
+class ModuleLoader;
 
 using InterpreterResult = Result<std::shared_ptr<Value>, const char*>;
 
 class Interpreter : public ASTVisitor<InterpreterResult>
 {
 public:
-	Interpreter();
+	/*
+	* Printed values are written to "output" and input reads its lines from "input".
+	* Builtins which run script functions in parallel use "pool", without a pool they run sequentially.
+	* Imported modules are loaded by "modules", without a loader imports are an error.
+	*/
+	Interpreter(OutputBuffer& output, InputBuffer& input, ThreadPool* pool = nullptr, ModuleLoader* modules = nullptr);
 
 	InterpreterResult interpret(const ASTNode&);
 
+	inline Heap::Stats get_heap_stats() const { return heap->get_stats(); }
+
+	//True while tasks spawned by the program, including those spawned by its tasks, are queued or running
+	inline bool has_running_tasks() const { return n_running_tasks->load() != 0; }
+
+	/*
+	* Calls and resumed generators nest on the native stack, deeper ones fail with "Stack overflow". Scripts have to
+	* run on a thread with at least stack_size(max_depth) bytes of stack (see StackThread) to reach the maximum depth,
+	* running out of stack before that also fails with "Stack overflow".
+	*/
+	static constexpr size_t default_max_depth = 100000;
+	inline void set_max_depth(size_t max_depth) { this->max_depth = max_depth; }
+	static size_t stack_size(size_t max_depth);
+
+	/*
+	* Limits the steps, time and memory of the execution including its workers, see Budget. Exceeding a limit aborts
+	* the running statement with the error of the limit, as do all statements after it.
+	*/
+	void set_limits(const Budget::Limits& limits);
+
+	//The error of the exceeded limit once the execution is aborted, nullptr otherwise
+	inline const char* get_abort_error() const { return budget ? budget->get_error() : nullptr; }
+
+	//Samples the functions and loops run by the execution including its workers, nullptr stops profiling
+	void set_profiler(std::shared_ptr<Profiler> profiler);
+
+	//A script function, it points into the tree so it stays valid as long as the tree
+	struct Function
+	{
+		const ASTFunctionNode* node;
+		const std::vector<std::string>* arg_names;
+		bool is_generator;
+	};
+
+	//Functions implemented in C++ which are callable from scripts, see Builtins.cpp
+	using NativeFunction = std::function<InterpreterResult(Interpreter&, const std::vector<std::shared_ptr<Value>>&)>;
+
+	//Resolves a function declared by the statements interpreted so far so it can be called without looking it up again
+	std::optional<Function> find_function(const std::string& name) const;
+
+	//Calls a resolved function from the host, the arguments must not be references
+	InterpreterResult call(const Function& func, const std::vector<std::shared_ptr<Value>>& args_values);
+
+	//Makes a native function callable from scripts like a builtin, user defined functions of the same name shadow it
+	void register_native(const std::string& name, size_t n_args, NativeFunction fn);
+
 	virtual InterpreterResult visit(const ASTLiteralNode&) override;
 	virtual InterpreterResult visit(const ASTIdentifierNode&) override;
 	virtual InterpreterResult visit(const ASTUnaryNode&) override;
@@ -33,26 +97,157 @@ public:
 	virtual InterpreterResult visit(const ASTFunctionNode&) override;
 	virtual InterpreterResult visit(const ASTCallNode&) override;
 	virtual InterpreterResult visit(const ASTReturnNode&) override;
+	virtual InterpreterResult visit(const ASTStructNode&) override;
+	virtual InterpreterResult visit(const ASTFieldNode&) override;
+	virtual InterpreterResult visit(const ASTFieldAssignmentNode&) override;
+	virtual InterpreterResult visit(const ASTSpawnNode&) override;
+	virtual InterpreterResult visit(const ASTAwaitNode&) override;
+	virtual InterpreterResult visit(const ASTYieldNode&) override;
+	virtual InterpreterResult visit(const ASTImportNode&) override;
+
+protected:
+	//A worker sharing the definitions, heap, output, input and pool of "parent", see create_worker
+	explicit Interpreter(const Interpreter* parent);
+
+	//Creates the worker that create_worker sets up, instrumented interpreters (see InstrumentedInterpreter) create their own type
+	virtual std::unique_ptr<Interpreter> new_worker() const;
+
 private:
+	struct Definitions;
+
+	Interpreter(std::shared_ptr<Definitions> definitions, std::shared_ptr<Heap> heap, OutputBuffer& output, InputBuffer& input, ThreadPool* pool);
+
+	//Evaluates an expression to a value, never returns a reference
 	InterpreterResult deref_expr(ASTNode* expr);
 
+	//Evaluates and dereferences the arguments of a call, only returns a value on error
+	InterpreterResult evaluate_args(const ASTCallNode& node, std::vector<std::shared_ptr<Value>>& args_values);
+
 	//Can reuse the same void everywhere
 	std::shared_ptr<VoidValue> void_val = std::make_shared<VoidValue>();
 
 	struct 
 	{
 		size_t n_function_calls = 0;
+		size_t n_running_generators = 0;
 	} runtime_data;
 
+	size_t max_depth = default_max_depth;
+	inline bool depth_exceeded() const
+	{
+		return runtime_data.n_function_calls + runtime_data.n_running_generators >= max_depth || stack_exhausted();
+	}
+
+	//Shared with the workers, null without limits
+	std::shared_ptr<Budget> budget;
+	//Steps are charged to the budget in chunks of budget_chunk steps
+	uint64_t budget_chunk = 0;
+	uint64_t uncharged_steps = 0;
+
+	//Shared with the workers, null unless profiling
+	std::shared_ptr<Profiler> profiler;
+	//The functions and loops being run, only kept while profiling
+	Profiler::Stack profile_stack;
+	Profiler::Clock::time_point next_sample;
+
+	/*
+	* The budget and the profiler are checked every few steps, the countdown runs to the next check. Without a
+	* budget and a profiler it never runs out.
+	*/
+	uint64_t step_chunk = UINT64_MAX;
+	uint64_t steps_until_check = UINT64_MAX;
+
+	void attach_budget(std::shared_ptr<Budget> budget);
+	void attach_profiler(std::shared_ptr<Profiler> profiler, const Profiler::Stack& stack);
+	void start_countdown();
+	const char* check_point();
+
+	//Counts a loop iteration or a function call, returns the error of the exceeded limit
+	inline const char* take_step()
+	{
+		if (--steps_until_check != 0)
+			return nullptr;
+		return check_point();
+	}
+
+	//Values created on this thread count against the memory limit until the scope ends, see MemoryAccount
+	inline MemoryAccount::Scope account_memory() const { return MemoryAccount::Scope(budget ? &budget->get_memory() : nullptr); }
+
+	//Set by a return statement while the blocks and loops of the function unwind, taken by call_function
+	std::shared_ptr<Value> return_value;
+
 	ScopeManager scope_manager;
 
-	struct Function
+	/*
+	* Maps, records and generators are allocated through the heap so that cycles between them can be collected.
+	* The heap is shared with the workers, only the interpreter which created it collects.
+	*/
+	std::shared_ptr<Heap> heap;
+	bool is_worker = false;
+
+	template <typename T, typename... Args>
+	std::shared_ptr<T> allocate(Args&&... args)
 	{
-		ASTBlockNode* body;
-		const std::vector<std::string>* arg_names;
+		auto value = std::make_shared<T>(std::forward<Args>(args)...);
+		heap->track(value);
+		return value;
+	}
+
+	//Collects cycles if enough containers were allocated, only called where no values live on the native stack
+	void safe_point();
+
+	ThreadPool* pool;
+	//The spawned tasks which haven't finished, shared with the workers. Other users of the pool aren't counted
+	std::shared_ptr<std::atomic<size_t>> n_running_tasks = std::make_shared<std::atomic<size_t>>(0);
+
+	//Only the interpreter running the top level statements imports modules
+	ModuleLoader* modules = nullptr;
+	//The directory of the module whose declarations are running, empty for the program
+	std::string module_directory;
+
+	//Shared with the workers, print_line is the line being printed
+	OutputBuffer& output;
+	std::string print_line;
+	InputBuffer& input;
+
+	InterpreterResult call_function(const Function& func, const std::vector<std::shared_ptr<Value>>& args_values);
+	InterpreterResult run_loop(const ASTWhileNode& node);
+
+	//Runs the generator until its next yield, returns void if the generator finished instead
+	InterpreterResult resume_generator(GeneratorValue& generator);
+	InterpreterResult step_generator(GeneratorValue& generator);
+
+	struct Builtin
+	{
+		size_t n_args;
+		NativeFunction fn;
+	};
+
+	struct Definitions
+	{
+		std::unordered_map<std::string, Function> function_table;
+
+		//Calling a struct by name constructs a record of it
+		std::unordered_map<std::string, std::shared_ptr<const StructLayout>> struct_table;
+
+		std::unordered_map<std::string, Builtin> builtin_table;
 	};
 
-	std::unordered_map<std::string, Function> function_table;
+	/*
+	* Definitions are shared with the worker interpreters that run functions on other threads.
+	* They are never modified while shared, instead they are copied before they are modified.
+	*/
+	std::shared_ptr<Definitions> definitions;
+	Definitions& definitions_for_write();
+
+	/*
+	* Creates an interpreter for running a function on another thread. The worker shares the definitions
+	* and has its own scopes, its global scope starts out as a copy of the global scope of this interpreter.
+	* Must not be called while this interpreter is running on another thread.
+	*/
+	std::unique_ptr<Interpreter> create_worker() const;
+
+	void register_builtins();
 
 	struct UnaryOperationVisitor : ValueVisitor
 	{
@@ -65,12 +260,18 @@ private:
 		InterpreterResult visit(const NumberValue<char>&) override;
 		InterpreterResult visit(const StringValue&) override;
 		inline InterpreterResult visit(const VoidValue&) override { return "Value is void"; };
+		inline InterpreterResult visit(const MapValue&) override { return "Cannot perform unary operation on map"; };
+		inline InterpreterResult visit(const RecordValue&) override { return "Cannot perform unary operation on record"; };
+		inline InterpreterResult visit(const GeneratorValue&) override { return "Cannot perform unary operation on generator"; };
+		inline InterpreterResult visit(const FutureValue&) override { return "Value is a future, use await"; };
 	private:
 		template<typename T>
 		inline InterpreterResult number_operation(const NumberValue<T>& value)
 		{
 			if (op == Operator::MINUS)
 				return { std::make_shared<NumberValue<T>>(value.value * -1) };
+
+			return "Unary operator is not supported on type";
 		}
 
 		Operator op;
@@ -89,6 +290,10 @@ private:
 		InterpreterResult visit(const NumberValue<char>&) override;
 		InterpreterResult visit(const StringValue&) override;
 		inline InterpreterResult visit(const VoidValue&) override { return "Value is void"; };
+		inline InterpreterResult visit(const MapValue&) override { return "Binary operator is not supported on map"; };
+		inline InterpreterResult visit(const RecordValue&) override { return "Binary operator is not supported on record"; };
+		inline InterpreterResult visit(const GeneratorValue&) override { return "Binary operator is not supported on generator"; };
+		inline InterpreterResult visit(const FutureValue&) override { return "Value is a future, use await"; };
 	private:
 		template<typename T>
 		inline InterpreterResult number_operation(const NumberValue<T>& lhs, Type type)
@@ -101,6 +306,10 @@ private:
 			//Could solve this by giving float a higher "casting precedence" or something like that
 			//But for now this is an okay and simple solution
 
+			//Operands of the same type don't need to be converted, NumberValue is final so the typeid check is enough
+			if (typeid(*other) == typeid(NumberValue<T>))
+				return apply(lhs, *static_cast<const NumberValue<T>*>(other));
+
 			//Implicit cast to compatible number type
 			//This also converts references to values
 			CastVisitor visitor(type);
@@ -109,57 +318,72 @@ private:
 				return "Types are not compatible in binary operation";
 
 			if (auto* rhs = dynamic_cast<NumberValue<T>*>((*rhs_res).get()))
-			{
-				switch (op)
-				{
-				case Operator::PLUS:
-					return { std::make_shared<NumberValue<T>>(lhs.value + rhs->value) };
-				case Operator::MINUS:
-					return { std::make_shared<NumberValue<T>>(lhs.value - rhs->value) };
-				case Operator::TIMES:
-					return { std::make_shared<NumberValue<T>>(lhs.value * rhs->value) };
-				case Operator::DIVIDED:
-					return { std::make_shared<NumberValue<T>>(lhs.value / rhs->value) };
-				case Operator::EQUALS:
-					return { std::make_shared<NumberValue<int>>(lhs.value == rhs->value) };  //TODO: For now int takes the place of bool
-				case Operator::LEQ:
-					return { std::make_shared<NumberValue<int>>(lhs.value <= rhs->value) };
-				case Operator::GEQ:
-					return { std::make_shared<NumberValue<int>>(lhs.value >= rhs->value) };
-				case Operator::LESS_THAN:
-					return { std::make_shared<NumberValue<int>>(lhs.value < rhs->value) };
-				case Operator::GREATER_THAN:
-					return { std::make_shared<NumberValue<int>>(lhs.value > rhs->value) };
-				case Operator::AND:
-					return { std::make_shared<NumberValue<int>>(lhs.is_truthy() && rhs->is_truthy()) };
-				case Operator::OR:
-					return { std::make_shared<NumberValue<int>>(lhs.is_truthy() || rhs->is_truthy()) };
-				}
-
-				return "Binary operator is not supported on type";
-			}
+				return apply(lhs, *rhs);
+
 			_ASSERT(false); //We should never reach this point as the cast should fail and return an error
 			return "Types are not compatible in binary operation";
 		}
+
+		template<typename T>
+		inline InterpreterResult apply(const NumberValue<T>& lhs, const NumberValue<T>& rhs)
+		{
+			switch (op)
+			{
+			case Operator::PLUS:
+				return { std::make_shared<NumberValue<T>>(lhs.value + rhs.value) };
+			case Operator::MINUS:
+				return { std::make_shared<NumberValue<T>>(lhs.value - rhs.value) };
+			case Operator::TIMES:
+				return { std::make_shared<NumberValue<T>>(lhs.value * rhs.value) };
+			case Operator::DIVIDED:
+				return { std::make_shared<NumberValue<T>>(lhs.value / rhs.value) };
+			case Operator::EQUALS:
+				return { std::make_shared<NumberValue<int>>(lhs.value == rhs.value) };  //TODO: For now int takes the place of bool
+			case Operator::LEQ:
+				return { std::make_shared<NumberValue<int>>(lhs.value <= rhs.value) };
+			case Operator::GEQ:
+				return { std::make_shared<NumberValue<int>>(lhs.value >= rhs.value) };
+			case Operator::LESS_THAN:
+				return { std::make_shared<NumberValue<int>>(lhs.value < rhs.value) };
+			case Operator::GREATER_THAN:
+				return { std::make_shared<NumberValue<int>>(lhs.value > rhs.value) };
+			case Operator::AND:
+				return { std::make_shared<NumberValue<int>>(lhs.is_truthy() && rhs.is_truthy()) };
+			case Operator::OR:
+				return { std::make_shared<NumberValue<int>>(lhs.is_truthy() || rhs.is_truthy()) };
+			}
+
+			return "Binary operator is not supported on type";
+		}
 		Operator op;
 		Value* other;
 	};
 
+	//Appends the printed form of a value to "out"
 	struct PrintVisitor : ValueVisitor
 	{
+		PrintVisitor(std::string& out)
+			: out(out) {};
+
 		InterpreterResult visit(const ReferenceValue&) override;
 		InterpreterResult visit(const NumberValue<int>&) override;
 		InterpreterResult visit(const NumberValue<float>&) override;
 		InterpreterResult visit(const NumberValue<char>&) override;
 		InterpreterResult visit(const StringValue&) override;
+		InterpreterResult visit(const MapValue&) override;
+		InterpreterResult visit(const RecordValue&) override;
+		inline InterpreterResult visit(const FutureValue&) override { return "Value is a future, use await"; };
+		inline InterpreterResult visit(const GeneratorValue&) override { return print(std::string_view("<generator>")); };
 		inline InterpreterResult visit(const VoidValue&) override { return "Value is void"; };
 	private:
 		template<typename T>
-		inline InterpreterResult print(T printable)
+		inline InterpreterResult print(const T& printable)
 		{
-			std::cout << ">> " << printable << std::endl;
+			OutputBuffer::append(out, printable);
 			return {};
 		}
+
+		std::string& out;
 	};
 
 	struct CastVisitor : ValueVisitor
@@ -173,6 +397,10 @@ private:
 		InterpreterResult visit(const NumberValue<char>&) override;
 		InterpreterResult visit(const StringValue&) override;
 		inline InterpreterResult visit(const VoidValue&) override { return "Value is void"; };
+		inline InterpreterResult visit(const MapValue&) override { return "Cannot cast map"; };
+		inline InterpreterResult visit(const RecordValue&) override { return "Cannot cast record"; };
+		inline InterpreterResult visit(const GeneratorValue&) override { return "Cannot cast generator"; };
+		inline InterpreterResult visit(const FutureValue&) override { return "Value is a future, use await"; };
 	private:
 		template<typename T>
 		inline InterpreterResult num_to_num(const NumberValue<T>& value)
@@ -3,70 +3,222 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <algorithm>
 
 #include "Lexer.h"
+#include "Stats.h"
 
-Result<std::vector<Token>> Lexer::tokenize(std::string text) 
+Result<std::vector<Token>> Lexer::tokenize(std::string_view text) 
 {
 	std::vector<Token> tokens;
-	m_position = 0;
-	while (text.size() > 0)
+	start(text);
+	while (true)
 	{
-		std::smatch match;
-		for (const auto& pattern : m_token_patterns)
+		Result<Token> token = next_token();
+		if (token.is_error())
+			return token.get_error();
+
+		tokens.push_back(*token);
+		if (tokens.back().type == TokenType::EOF_TOKEN)
+			return tokens;
+	}
+}
+
+void Lexer::start(std::string_view text, size_t position)
+{
+	m_current = text.data();
+	m_end = text.data() + text.size();
+	m_position = position;
+}
+
+Result<Token> Lexer::next_token()
+{
+	STATS_LEX_TIMER();
+	while (m_current != m_end)
+	{
+		size_t length = 0;
+		std::string_view content;
+		int pattern = WHITESPACE;
+		for (; pattern <= SPECIAL; ++pattern)
 		{
-			if (std::regex_search(text, match, pattern.second, std::regex_constants::match_continuous)) //Only match at start of string
-			{
-				const std::string& value = match[0];
-				if (pattern.first != WHITESPACE && pattern.first != COMMENT)
-				{
-					switch (pattern.first)
-					{
-					case NUMBER: tokens.push_back(tokenize_number(value));
-						break;
-					case TEXT: tokens.push_back(tokenize_text(value));
-						break;
-					case CHAR_LITERAL: tokens.push_back(Token(TokenType::LITERAL, { { "data_type", "char" }, { "value", match[1]} }, m_position));
-						break;
-					case STRING_LITERAL: tokens.push_back(Token(TokenType::LITERAL, { { "data_type", "string" }, { "value", match[1]}}, m_position));
-						break;
-					case OPERATOR: tokens.push_back(Token(TokenType::OPERATOR, { { "value", value } }, m_position));
-						break;
-					case SPECIAL: tokens.push_back(Token(TokenType::SPECIAL_CHAR, { { "value", value } }, m_position));
-						break;
-					}
-				}
-				text = text.substr(value.size());
-				m_position += value.size();
+			length = match_pattern(pattern, m_current, m_end, content);
+			if (length != 0)
 				break;
-			}
 		}
-		if (match.empty())
+		if (length == 0)
 			return Error("Lexer error", m_position);
+
+		std::string_view value(m_current, length);
+		size_t position = m_position;
+		m_current += length;
+		m_position += length;
+
+		switch (pattern)
+		{
+		case NUMBER: return tokenize_number(value, position);
+		case TEXT: return tokenize_text(value, position);
+		case CHAR_LITERAL: return Token(TokenType::LITERAL, content, position, LiteralType::CHAR);
+		case STRING_LITERAL: return Token(TokenType::LITERAL, content, position, LiteralType::STRING);
+		case OPERATOR: return Token(TokenType::OPERATOR, value, position);
+		case SPECIAL: return Token(TokenType::SPECIAL_CHAR, value, position);
+		}
+		//Whitespace and comments don't produce tokens
 	}
 
-	tokens.push_back(Token(TokenType::EOF_TOKEN, {}, m_position));
-	return tokens;
+	return Token(TokenType::EOF_TOKEN, {}, m_position);
 }
 
-Token Lexer::tokenize_text(const std::string& value)
+Token Lexer::tokenize_text(std::string_view value, size_t position)
 {
 	if (std::find(m_keywords.begin(), m_keywords.end(), value) != m_keywords.end())
 	{
-		return Token(TokenType::KEYWORD, { { "value", value } }, m_position);
+		return Token(TokenType::KEYWORD, value, position);
 	}
 	if (std::find(m_types.begin(), m_types.end(), value) != m_types.end())
 	{
-		return Token(TokenType::TYPE, { { "value", value } }, m_position);
+		return Token(TokenType::TYPE, value, position);
 	}
-	return Token(TokenType::IDENTIFIER, { { "name", value } }, m_position);
+	return Token(TokenType::IDENTIFIER, value, position);
 }
 
-Token Lexer::tokenize_number(const std::string& value)
+Token Lexer::tokenize_number(std::string_view value, size_t position)
 {
-	if (value.find('.') != std::string::npos)
+	if (value.find('.') != std::string_view::npos)
 	{
-		return Token(TokenType::LITERAL, { { "data_type", "float" }, { "value", value } }, m_position);
+		return Token(TokenType::LITERAL, value, position, LiteralType::FLOAT);
 	}
-	return Token(TokenType::LITERAL, { { "data_type", "integer" }, { "value", value } }, m_position);
-}
\ No newline at end of file
+	return Token(TokenType::LITERAL, value, position, LiteralType::INTEGER);
+}
+
+//Character classes of the patterns, "." doesn't match line terminators
+static bool is_space(char c) { return c == ' ' || (c >= '\t' && c <= '\r'); }
+static bool is_digit(char c) { return c >= '0' && c <= '9'; }
+static bool is_alpha(char c) { return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_'; }
+static bool is_any(char c) { return c != '\n' && c != '\r'; }
+
+size_t Lexer::match_pattern(int pattern, const char* begin, const char* end, std::string_view& content) const
+{
+	const char* p = begin;
+	switch (pattern)
+	{
+	case WHITESPACE:
+		while (p != end && is_space(*p))
+			++p;
+		return p - begin;
+
+	case COMMENT:
+		if (end - p < 2 || p[0] != '/')
+			return 0;
+		if (p[1] == '/')
+		{
+			p += 2;
+			while (p != end && is_any(*p))
+				++p;
+			if (p != end && *p == '\n')
+				++p;
+			return p - begin;
+		}
+		if (p[1] == '*')
+		{
+			//"(?:.|\n)" doesn't match \r so neither does this
+			for (p += 2; end - p >= 2 && (is_any(*p) || *p == '\n'); ++p)
+			{
+				if (p[0] == '*' && p[1] == '/')
+					return p + 2 - begin;
+			}
+		}
+		return 0;
+
+	case NUMBER:
+		while (p != end && is_digit(*p))
+			++p;
+		//The fraction needs at least one digit, "1." is the number "1" followed by "."
+		if (end - p >= 2 && p[0] == '.' && is_digit(p[1]))
+		{
+			for (p += 1; p != end && is_digit(*p); ++p);
+		}
+		return p - begin;
+
+	case TEXT:
+		if (!is_alpha(*p))
+			return 0;
+		for (++p; p != end && (is_alpha(*p) || is_digit(*p)); ++p);
+		return p - begin;
+
+	case CHAR_LITERAL:
+		if (end - p < 3 || p[0] != '\'' || !is_any(p[1]) || p[2] != '\'')
+			return 0;
+		content = std::string_view(p + 1, 1);
+		return 3;
+
+	case STRING_LITERAL:
+		//The contents are at least one character long, even if it is a quote
+		if (end - p < 3 || p[0] != '"' || !is_any(p[1]))
+			return 0;
+		for (p += 2; p != end && is_any(*p); ++p)
+		{
+			if (*p == '"')
+			{
+				content = std::string_view(begin + 1, p - begin - 1);
+				return p + 1 - begin;
+			}
+		}
+		return 0;
+
+	case OPERATOR:
+		if (end - p >= 2)
+		{
+			std::string_view two(p, 2);
+			if (two == ":=" || two == "&&" || two == "||" || two == ">=" || two == "<=" || two == "==")
+				return 2;
+		}
+		return std::string_view("+-*/<>").find(*p) != std::string_view::npos ? 1 : 0;
+
+	case SPECIAL:
+		return std::string_view(";()[]{},.").find(*p) != std::string_view::npos ? 1 : 0;
+	}
+	return 0;
+}
+
+std::vector<size_t> Lexer::find_statement_ends(std::string_view text, size_t min_chunk_size) const
+{
+	STATS_LEX_TIMER();
+	std::vector<size_t> ends;
+	size_t chunk_start = 0;
+	int depth = 0;
+
+	const char* begin = text.data();
+	const char* end = text.data() + text.size();
+	for (const char* p = begin; p != end; ++p)
+	{
+		switch (*p)
+		{
+		case '/':
+		case '"':
+		case '\'':
+		{
+			//These always start a token outside of literals and comments, which are skipped whole
+			std::string_view content;
+			int pattern = *p == '/' ? COMMENT : *p == '"' ? STRING_LITERAL : CHAR_LITERAL;
+			size_t length = match_pattern(pattern, p, end, content);
+			if (length != 0)
+				p += length - 1;
+			break;
+		}
+		case '(': case '[': case '{':
+			++depth;
+			break;
+		case ')': case ']': case '}':
+			--depth;
+			break;
+		case ';':
+			if (depth == 0 && static_cast<size_t>(p + 1 - begin) - chunk_start >= min_chunk_size)
+			{
+				chunk_start = p + 1 - begin;
+				ends.push_back(chunk_start);
+			}
+			break;
+		}
+	}
+	return ends;
+}
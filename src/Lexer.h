@@ -4,8 +4,8 @@
 #include <unordered_map>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <array>
-#include <regex>
 
 #include "Result.h"
 #include "Token.h"
@@ -13,11 +13,26 @@
 class Lexer
 {
 public:
-	Result<std::vector<Token>> tokenize(std::string text);
+	//The tokens reference "text", it has to outlive them
+	Result<std::vector<Token>> tokenize(std::string_view text);
+
+	//Produces the tokens of "text" one at a time through next_token() instead of all at once
+	//"position" is the position of the text in the whole source, it is added to the token positions
+	void start(std::string_view text, size_t position = 0);
+	//Returns the EOF token once the end of the text is reached
+	Result<Token> next_token();
+
+	/*
+	* Returns the offsets just after the ";" which end top level statements (outside of brackets, literals
+	* and comments), skipping ends until at least "min_chunk_size" characters are left behind the last one.
+	* Only one character at a time is looked at outside of literals and comments, so this is a lot faster
+	* than lexing the text. On text with lexer errors the chunks may not match the statements.
+	*/
+	std::vector<size_t> find_statement_ends(std::string_view text, size_t min_chunk_size) const;
 
 private:
-	Token tokenize_text(const std::string& value);
-	Token tokenize_number(const std::string& value);
+	Token tokenize_text(std::string_view value, size_t position);
+	Token tokenize_number(std::string_view value, size_t position);
 
 	enum 
 	{
@@ -31,27 +46,32 @@ private:
 		SPECIAL
 	};
 
-	const std::vector<std::pair<int, std::regex>> m_token_patterns
-	{
-		{ WHITESPACE, std::regex("\\s+")},
-		{ COMMENT, std::regex("(?:\\/\\/.*\\n?|\\/\\*(?:.|\\n)*?\\*\\/)")},
-		{ NUMBER, std::regex("[0-9]*\\.?[0-9]+")},
-		{ TEXT, std::regex("[a-zA-Z_]\\w*")},
-		{ CHAR_LITERAL, std::regex("'(.)'")},
-		{ STRING_LITERAL, std::regex("\"(.+?)\"")},
-		{ OPERATOR, std::regex("(?::=|&&|\\|\\||>=|<=|==|[+\\-*\\/<>])")},
-		{ SPECIAL, std::regex("[;()\\[\\]{},]")},
-	};
+	/*
+	* The patterns are tried in this order and the first one which matches at the current position is used:
+	* WHITESPACE      \s+
+	* COMMENT         \/\/.*\n?|\/\*(?:.|\n)*?\*\/
+	* NUMBER          [0-9]*\.?[0-9]+
+	* TEXT            [a-zA-Z_]\w*
+	* CHAR_LITERAL    '(.)'
+	* STRING_LITERAL  "(.+?)"
+	* OPERATOR        :=|&&|\|\||>=|<=|==|[+\-*\/<>]
+	* SPECIAL         [;()\[\]{},.]
+	* They are matched by hand rather than with std::regex, which is too slow for large sources.
+	* Returns the length of the match or 0, "content" is set to the contents of literals.
+	*/
+	size_t match_pattern(int pattern, const char* begin, const char* end, std::string_view& content) const;
 
-	const std::vector<std::string> m_keywords
+	const std::vector<std::string_view> m_keywords
 	{
-		"fn", "let", "if", "else", "ret", "while", "print", "input"
+		"fn", "let", "if", "else", "ret", "while", "print", "input", "struct", "spawn", "await", "yield", "import"
 	};
 
-	const std::vector<std::string> m_types
+	const std::vector<std::string_view> m_types
 	{
 		"int", "float", "char", "string"
 	};
 
+	const char* m_current = nullptr;
+	const char* m_end = nullptr;
 	size_t m_position = 0;
 };
\ No newline at end of file
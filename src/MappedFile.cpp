@@ -0,0 +1,120 @@
+#include "MappedFile.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+	HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return nullptr;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size))
+	{
+		CloseHandle(file);
+		return nullptr;
+	}
+
+	std::shared_ptr<MappedFile> mapped(new MappedFile());
+	mapped->m_file = file;
+	mapped->m_size = static_cast<size_t>(size.QuadPart);
+
+	//Empty files can't be mapped but they are valid
+	if (mapped->m_size == 0)
+		return mapped;
+
+	mapped->m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapped->m_mapping)
+		return nullptr;
+
+	mapped->m_data = static_cast<const char*>(MapViewOfFile(mapped->m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!mapped->m_data)
+		return nullptr;
+
+	return mapped;
+}
+
+std::shared_ptr<MappedFile> MappedFile::open_descriptor(int)
+{
+	//Redirected stdin is read in blocks instead on Windows
+	return nullptr;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+}
+
+void MappedFile::release(size_t, size_t) const
+{
+	//Windows trims the working set of mapped files on its own
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+	int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return nullptr;
+
+	//The mapping stays valid after the descriptor is closed
+	std::shared_ptr<MappedFile> mapped = open_descriptor(fd);
+	close(fd);
+	return mapped;
+}
+
+std::shared_ptr<MappedFile> MappedFile::open_descriptor(int fd)
+{
+	struct stat info;
+	if (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode))
+		return nullptr;
+
+	std::shared_ptr<MappedFile> mapped(new MappedFile());
+	mapped->m_size = static_cast<size_t>(info.st_size);
+
+	//Empty files can't be mapped but they are valid
+	if (mapped->m_size == 0)
+		return mapped;
+
+	void* data = mmap(nullptr, mapped->m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+		return nullptr;
+
+	madvise(data, mapped->m_size, MADV_SEQUENTIAL);
+	mapped->m_data = static_cast<const char*>(data);
+	return mapped;
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data)
+		munmap(const_cast<char*>(m_data), m_size);
+}
+
+void MappedFile::release(size_t begin, size_t end) const
+{
+	//madvise works on whole pages, only pages completely inside the range are released
+	static const size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	begin = (begin + page_size - 1) / page_size * page_size;
+	end = end / page_size * page_size;
+	if (m_data && begin < end)
+		madvise(const_cast<char*>(m_data) + begin, end - begin, MADV_DONTNEED);
+}
+
+#endif
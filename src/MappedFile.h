@@ -0,0 +1,46 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*
+* A file mapped read only into memory.
+* Strings created from the file reference the mapping instead of copying it and keep the
+* MappedFile alive through their owner pointer, see StringValue.
+*/
+class MappedFile
+{
+public:
+	//Returns nullptr if the file can't be opened or mapped
+	static std::shared_ptr<MappedFile> open(const std::string& path);
+
+	//Maps the regular file open as "fd" (such as a redirected stdin), returns nullptr for pipes and terminals
+	static std::shared_ptr<MappedFile> open_descriptor(int fd);
+
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	inline const char* data() const { return m_data; }
+	inline size_t size() const { return m_size; }
+	inline std::string_view view() const { return { m_data, m_size }; }
+
+	/*
+	* Tells the OS that [begin, end) won't be read again soon so its pages can be dropped, which keeps the
+	* memory use of a sequential scan flat. The contents stay valid, dropped pages are read from the file again.
+	*/
+	void release(size_t begin, size_t end) const;
+
+private:
+	MappedFile() = default;
+
+	const char* m_data = nullptr;
+	size_t m_size = 0;
+
+#ifdef _WIN32
+	void* m_file = nullptr;
+	void* m_mapping = nullptr;
+#endif
+};
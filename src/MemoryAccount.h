@@ -0,0 +1,86 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+
+/*
+* The bytes held by the values of one execution, which the memory limit (see Budget) is checked against. Strings,
+* maps, records and generators charge the account of the thread creating them (see Scope) and release their bytes
+* when they are freed, on whichever thread that happens. Numbers and the other small values are not counted, they
+* are mostly short lived and the slots of the maps and records holding the others are.
+*/
+class MemoryAccount
+{
+public:
+	inline size_t get_bytes() const { return m_bytes.load(std::memory_order_relaxed); }
+
+	inline void charge(size_t n_bytes) { m_bytes.fetch_add(n_bytes, std::memory_order_relaxed); }
+	inline void release(size_t n_bytes) { m_bytes.fetch_sub(n_bytes, std::memory_order_relaxed); }
+
+	//Values created on the thread are charged to "account" until the scope ends, null counts nothing
+	class Scope
+	{
+	public:
+		inline explicit Scope(const std::shared_ptr<MemoryAccount>* account)
+			: m_previous(s_current)
+		{
+			s_current = account && *account ? account : nullptr;
+		}
+		inline ~Scope() { s_current = m_previous; }
+
+		Scope(const Scope&) = delete;
+		Scope& operator=(const Scope&) = delete;
+
+	private:
+		const std::shared_ptr<MemoryAccount>* m_previous;
+	};
+
+	//The account of the execution running on this thread, nullptr if there is none
+	static inline const std::shared_ptr<MemoryAccount>* current() { return s_current; }
+
+private:
+	std::atomic<size_t> m_bytes{ 0 };
+
+	static inline thread_local const std::shared_ptr<MemoryAccount>* s_current = nullptr;
+};
+
+//The bytes of one value, charged to the current account when created and released when destroyed
+class MemoryCharge
+{
+public:
+	inline explicit MemoryCharge(size_t n_bytes)
+	{
+		if (const std::shared_ptr<MemoryAccount>* account = MemoryAccount::current())
+		{
+			m_account = *account;
+			m_bytes = n_bytes;
+			m_account->charge(n_bytes);
+		}
+	}
+
+	inline ~MemoryCharge()
+	{
+		if (m_account)
+			m_account->release(m_bytes);
+	}
+
+	MemoryCharge(const MemoryCharge&) = delete;
+	MemoryCharge& operator=(const MemoryCharge&) = delete;
+
+	//For values which grow or shrink after they are created
+	inline void resize(size_t n_bytes)
+	{
+		if (!m_account)
+			return;
+		if (n_bytes > m_bytes)
+			m_account->charge(n_bytes - m_bytes);
+		else
+			m_account->release(m_bytes - n_bytes);
+		m_bytes = n_bytes;
+	}
+
+private:
+	std::shared_ptr<MemoryAccount> m_account;
+	size_t m_bytes = 0;
+};
@@ -0,0 +1,121 @@
+#include "ModuleLoader.h"
+#include "ASTCache.h"
+#include "Lexer.h"
+#include "ParallelParser.h"
+
+#include <algorithm>
+#include <cctype>
+
+ModuleLoader::ModuleLoader(const std::string& program_path)
+	: m_base_dir(std::filesystem::path(program_path).parent_path())
+{}
+
+Result<const ModuleLoader::Module*, const char*> ModuleLoader::load(const std::string& path, const std::string& directory, ThreadPool& pool)
+{
+	std::filesystem::path file(path);
+	if (file.is_relative())
+		file = (directory.empty() ? m_base_dir : std::filesystem::path(directory)) / file;
+
+	//Different paths to the same file are the same module
+	std::error_code canonical_error;
+	std::filesystem::path canonical = std::filesystem::weakly_canonical(file, canonical_error);
+	std::string key = (canonical_error ? file.lexically_normal() : canonical).string();
+
+	const Module* imported = nullptr;
+	if (m_modules.count(key))
+		return imported;
+
+	std::string name_space = file.stem().string();
+	if (name_space.empty() || std::isdigit(static_cast<unsigned char>(name_space[0])) ||
+		!std::all_of(name_space.begin(), name_space.end(), [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_'; }))
+		return error("Module name is not an identifier: " + path);
+
+	auto namespace_it = m_namespaces.find(name_space);
+	if (namespace_it != m_namespaces.end())
+		return error("Namespace " + name_space + " is already used by module " + namespace_it->second);
+
+	std::shared_ptr<MappedFile> source = MappedFile::open(key);
+	if (!source)
+		return error("Cannot open module: " + path);
+
+	//An unchanged module is loaded from its cache, otherwise it is parsed and the cache is replaced
+	std::vector<std::unique_ptr<ASTNode>> declarations;
+	ASTCache cache(key, m_cache_dir, source->view(), name_space);
+	auto cache_res = cache.load();
+	if (!cache_res.is_error())
+		declarations = std::move(*cache_res);
+	else
+	{
+		auto parse_res = parse(path, name_space, source, pool);
+		if (parse_res.is_error())
+			return parse_res.get_error();
+		declarations = std::move(*parse_res);
+		cache.store(declarations);
+	}
+
+	for (const auto& declaration : declarations)
+	{
+		if (!dynamic_cast<const ASTFunctionNode*>(declaration.get()) && !dynamic_cast<const ASTStructNode*>(declaration.get()) &&
+			!dynamic_cast<const ASTImportNode*>(declaration.get()))
+			return error("Module can only declare functions, structs and imports: " + path);
+	}
+
+	//Registered before its declarations run so that modules importing each other are only loaded once
+	m_namespaces.emplace(name_space, key);
+	Module& module = m_modules[key];
+	module.directory = std::filesystem::path(key).parent_path().string();
+	module.name_space = name_space;
+	module.source = std::move(source);
+	module.declarations = std::move(declarations);
+	return &module;
+}
+
+Result<std::vector<std::unique_ptr<ASTNode>>, const char*> ModuleLoader::parse(const std::string& path, const std::string& name_space, const std::shared_ptr<MappedFile>& source, ThreadPool& pool)
+{
+	auto module_namespace = std::make_shared<Parser::Namespace>();
+	module_namespace->prefix = name_space + ".";
+	module_namespace->names = find_declarations(source->view());
+
+	ParallelParser parser(pool);
+	parser.set_lazy_functions(m_lazy_functions);
+	parser.set_namespace(module_namespace);
+	auto parser_res = parser.parse(source->view(), source);
+	if (parser_res.is_error())
+	{
+		const Error& first = parser_res.get_error().front();
+		return error(std::string(first.message) + " at: " + std::to_string(first.position) + " in module " + path);
+	}
+	return std::move(*parser_res);
+}
+
+std::unordered_set<std::string> ModuleLoader::find_declarations(std::string_view text)
+{
+	//The identifier after "fn" or "struct" outside of any braces, a lexer error is reported by the parser
+	std::unordered_set<std::string> names;
+	Lexer lexer;
+	lexer.start(text);
+	size_t depth = 0;
+	bool declaring = false;
+	while (true)
+	{
+		Result<Token> token_res = lexer.next_token();
+		if (token_res.is_error() || (*token_res).type == TokenType::EOF_TOKEN)
+			break;
+
+		const Token& token = *token_res;
+		if (declaring && token.type == TokenType::IDENTIFIER)
+			names.emplace(token.get_text());
+		declaring = depth == 0 && (token.is(TokenType::KEYWORD, "fn") || token.is(TokenType::KEYWORD, "struct"));
+
+		if (token.is(TokenType::SPECIAL_CHAR, "{"))
+			++depth;
+		else if (token.is(TokenType::SPECIAL_CHAR, "}") && depth > 0)
+			--depth;
+	}
+	return names;
+}
+
+const char* ModuleLoader::error(const std::string& message)
+{
+	return m_errors.emplace_back(message).c_str();
+}
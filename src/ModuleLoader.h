@@ -0,0 +1,73 @@
+#pragma once
+
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "AST.h"
+#include "MappedFile.h"
+#include "Parser.h"
+#include "Result.h"
+#include "ThreadPool.h"
+
+/*
+* Loads the modules imported by a program. A module is a file which only declares functions, structs and imports.
+* Its namespace is the file name without the extension and the names it declares are prefixed with it, so
+* `import "lib/math.txt";` makes `fn sqrt(x)` callable as `math.sqrt(x)`. Calls inside the module to its own
+* functions and structs are prefixed when it is parsed.
+* Every module is parsed once and cached (see ASTCache). An unchanged module is loaded from its cache without
+* lexing or parsing it and its function bodies are only read from the cache when they are called.
+*/
+class ModuleLoader
+{
+public:
+	struct Module
+	{
+		//Imports in the module are relative to its directory
+		std::string directory;
+		//Its names are prefixed with the namespace and a dot
+		std::string name_space;
+		std::shared_ptr<MappedFile> source;
+		std::vector<std::unique_ptr<ASTNode>> declarations;
+	};
+
+	explicit ModuleLoader(const std::string& program_path);
+
+	//See Parser::set_lazy_functions
+	inline void set_lazy_functions(bool lazy_functions) { m_lazy_functions = lazy_functions; }
+
+	//The caches are written next to the modules, or into "cache_dir" if it isn't empty
+	inline void set_cache_dir(const std::string& cache_dir) { m_cache_dir = cache_dir; }
+
+	/*
+	* Returns the module whose declarations define its functions and structs when they are run, or nullptr if it
+	* was already imported. A relative "path" is resolved against "directory", or against the directory of the
+	* program if it is empty. Modules are kept alive as long as the loader, the ones which aren't cached are
+	* lexed and parsed on "pool".
+	*/
+	Result<const Module*, const char*> load(const std::string& path, const std::string& directory, ThreadPool& pool);
+
+private:
+	//Parses a module which has no usable cache
+	Result<std::vector<std::unique_ptr<ASTNode>>, const char*> parse(const std::string& path, const std::string& name_space, const std::shared_ptr<MappedFile>& source, ThreadPool& pool);
+
+	//The names of the functions and structs declared at the top level of "text"
+	static std::unordered_set<std::string> find_declarations(std::string_view text);
+
+	//Errors name the module, their messages are kept here since errors are returned as plain strings
+	const char* error(const std::string& message);
+
+	std::filesystem::path m_base_dir;
+	bool m_lazy_functions = false;
+	std::string m_cache_dir;
+
+	//Loaded modules by their absolute path and the path of the module using each namespace
+	std::unordered_map<std::string, Module> m_modules;
+	std::unordered_map<std::string, std::string> m_namespaces;
+	std::deque<std::string> m_errors;
+};
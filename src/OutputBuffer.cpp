@@ -0,0 +1,92 @@
+#include "OutputBuffer.h"
+
+#include <charconv>
+#include <cstring>
+
+OutputBuffer::OutputBuffer(FILE* file, size_t capacity)
+	: m_file(file)
+	, m_buffer(capacity)
+{}
+
+OutputBuffer::OutputBuffer(std::string& capture, size_t capacity)
+	: m_capture(&capture)
+	, m_buffer(capacity)
+{}
+
+OutputBuffer::~OutputBuffer()
+{
+	flush();
+}
+
+void OutputBuffer::write(std::string_view text)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	if (m_size + text.size() > m_buffer.size())
+		flush_buffer();
+
+	//Text which doesn't fit into the buffer at all is written directly
+	if (text.size() > m_buffer.size())
+		write_out(text.data(), text.size());
+	else
+	{
+		std::memcpy(m_buffer.data() + m_size, text.data(), text.size());
+		m_size += text.size();
+	}
+
+	if (m_line_buffered)
+	{
+		flush_buffer();
+		if (m_file)
+			std::fflush(m_file);
+	}
+}
+
+void OutputBuffer::flush()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	flush_buffer();
+	if (m_file)
+		std::fflush(m_file);
+}
+
+void OutputBuffer::flush_buffer()
+{
+	if (m_size == 0)
+		return;
+
+	write_out(m_buffer.data(), m_size);
+	m_size = 0;
+}
+
+void OutputBuffer::write_out(const char* data, size_t size)
+{
+	if (m_capture)
+		m_capture->append(data, size);
+	else
+		std::fwrite(data, 1, size, m_file);
+}
+
+void OutputBuffer::append(std::string& out, int value)
+{
+	char digits[16];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value);
+	out.append(digits, result.ptr);
+}
+
+void OutputBuffer::append(std::string& out, float value)
+{
+	char digits[32];
+	auto result = std::to_chars(digits, digits + sizeof(digits), value, std::chars_format::general, 6);
+	out.append(digits, result.ptr);
+}
+
+void OutputBuffer::append(std::string& out, char value)
+{
+	out.push_back(value);
+}
+
+void OutputBuffer::append(std::string& out, std::string_view value)
+{
+	out.append(value);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <mutex>
+
+/*
+* Collects the output of print statements and writes it to the file in large blocks.
+* The buffer is only flushed when it is full, before reading input, on exit or after every write
+* when it is line buffered. Writes are thread safe and every write ends up in the output as a whole,
+* so lines printed from different threads never interleave.
+*/
+class OutputBuffer
+{
+public:
+	explicit OutputBuffer(FILE* file, size_t capacity = 1 << 16);
+	//Captures the output by appending it to "capture" instead of writing it to a file
+	explicit OutputBuffer(std::string& capture, size_t capacity = 1 << 16);
+	~OutputBuffer();
+
+	OutputBuffer(const OutputBuffer&) = delete;
+	OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+	void write(std::string_view text);
+	void flush();
+
+	//Flushes after every write, for interactive use
+	inline void set_line_buffered(bool line_buffered) { m_line_buffered = line_buffered; }
+
+	//Locale independent formatting, floats are formatted like iostreams do by default (6 significant digits)
+	static void append(std::string& out, int value);
+	static void append(std::string& out, float value);
+	static void append(std::string& out, char value);
+	static void append(std::string& out, std::string_view value);
+
+private:
+	//Must hold m_mutex
+	void flush_buffer();
+	void write_out(const char* data, size_t size);
+
+	FILE* m_file = nullptr;
+	std::string* m_capture = nullptr;
+	std::vector<char> m_buffer;
+	size_t m_size = 0;
+	bool m_line_buffered = false;
+	std::mutex m_mutex;
+};
@@ -0,0 +1,80 @@
+#include "ParallelParser.h"
+#include "Lexer.h"
+#include "Parser.h"
+
+#include <algorithm>
+
+//Chunks smaller than this aren't worth a task
+static constexpr size_t min_chunk_size = 64 * 1024;
+
+ParallelParser::ParallelParser(ThreadPool& pool)
+	: m_pool(pool)
+{}
+
+Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> ParallelParser::parse(std::string_view text, std::shared_ptr<const void> source)
+{
+	//Many more chunks than threads so stealing can even out chunks which take longer to parse
+	size_t chunk_size = std::max(min_chunk_size, text.size() / (m_pool.get_thread_count() * 16));
+	std::vector<size_t> chunk_ends = Lexer().find_statement_ends(text, chunk_size);
+	if (chunk_ends.empty() || chunk_ends.back() != text.size())
+		chunk_ends.push_back(text.size());
+
+	struct Chunk
+	{
+		std::vector<std::unique_ptr<ASTNode>> stmts;
+		bool failed = false;
+	};
+	std::vector<Chunk> chunks(chunk_ends.size());
+
+	m_pool.parallel_for(0, chunks.size(), [&](size_t begin, size_t end)
+	{
+		for (size_t i = begin; i < end; ++i)
+		{
+			size_t chunk_begin = i == 0 ? 0 : chunk_ends[i - 1];
+			Lexer lexer;
+			lexer.start(text.substr(chunk_begin, chunk_ends[i] - chunk_begin), chunk_begin);
+			Parser parser;
+			parser.set_lazy_functions(m_lazy_functions);
+			parser.set_namespace(m_namespace);
+			parser.start(lexer, source);
+			while (true)
+			{
+				auto res = parser.parse_next();
+				if (res.is_error())
+				{
+					chunks[i].failed = true;
+					break;
+				}
+				if (!*res)
+					break;
+				chunks[i].stmts.push_back(std::move(*res));
+			}
+		}
+	});
+
+	size_t n_stmts = 0;
+	for (const auto& chunk : chunks)
+	{
+		if (chunk.failed)
+			return parse_sequential(text, source);
+		n_stmts += chunk.stmts.size();
+	}
+
+	std::vector<std::unique_ptr<ASTNode>> stmts;
+	stmts.reserve(n_stmts);
+	for (auto& chunk : chunks)
+		std::move(chunk.stmts.begin(), chunk.stmts.end(), std::back_inserter(stmts));
+	return stmts;
+}
+
+Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> ParallelParser::parse_sequential(std::string_view text, const std::shared_ptr<const void>& source)
+{
+	auto lexer_res = Lexer().tokenize(text);
+	if (lexer_res.is_error())
+		return std::vector<Error>{ lexer_res.get_error() };
+
+	Parser parser;
+	parser.set_lazy_functions(m_lazy_functions);
+	parser.set_namespace(m_namespace);
+	return parser.parse(*lexer_res, source);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <string_view>
+#include <vector>
+
+#include "AST.h"
+#include "Error.h"
+#include "Parser.h"
+#include "Result.h"
+#include "ThreadPool.h"
+
+/*
+* Lexes and parses a source on a thread pool.
+* The source is split into chunks after top level ";" (see Lexer::find_statement_ends), the chunks are lexed
+* and parsed concurrently and their statements are joined in source order. Only top level statements are
+* separated by ";" outside of brackets, so every chunk holds whole statements.
+* If any chunk has an error the source is parsed again on the calling thread, so the errors and their
+* order are exactly the ones of a sequential parse.
+*/
+class ParallelParser
+{
+public:
+	explicit ParallelParser(ThreadPool& pool);
+
+	//See Parser::set_lazy_functions
+	inline void set_lazy_functions(bool lazy_functions) { m_lazy_functions = lazy_functions; }
+
+	//See Parser::set_namespace
+	inline void set_namespace(std::shared_ptr<const Parser::Namespace> name_space) { m_namespace = std::move(name_space); }
+
+	//Lexer errors are returned as the only error like with a sequential parse
+	Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> parse(std::string_view text, std::shared_ptr<const void> source = nullptr);
+
+private:
+	Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> parse_sequential(std::string_view text, const std::shared_ptr<const void>& source);
+
+	ThreadPool& m_pool;
+	bool m_lazy_functions = false;
+	std::shared_ptr<const Parser::Namespace> m_namespace;
+};
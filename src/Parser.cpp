@@ -1,31 +1,57 @@
-#pragma once
-
 #include "Parser.h"
 
 Parser::Parser()
 	: m_index(0)
 	, m_current_token(nullptr)
-	, m_tokens(nullptr)
 {
 }
 
 void Parser::advance()
 {
 	m_index++;
-	if (m_index < m_tokens->size())
-	{
-		m_current_token = &(*m_tokens)[m_index];
-	}
+	m_current_token = &token_at(m_index);
 }
 
 //Get the previous token
 const Token& Parser::prev(size_t n)
 {
-	if (m_index - n >= 0)
+	if (m_index >= m_buffer_start + n)
+	{
+		return token_at(m_index - n);
+	}
+
+	static const Token eof_token(TokenType::EOF_TOKEN, {}, 0);
+	return eof_token;
+}
+
+const Token& Parser::token_at(size_t index)
+{
+	while (index >= m_buffer_start + m_buffer.size() && !m_reached_end)
+	{
+		Result<Token> token = m_next_token();
+		if (token.is_error())
+		{
+			//The statements end where the lexer failed
+			m_lexer_error = token.get_error();
+			m_buffer.push_back(Token(TokenType::EOF_TOKEN, {}, m_lexer_error->position));
+		}
+		else
+			m_buffer.push_back(*token);
+		m_reached_end = m_buffer.back().type == TokenType::EOF_TOKEN;
+	}
+
+	if (index < m_buffer_start + m_buffer.size())
+		return m_buffer[index - m_buffer_start];
+	return m_buffer.back();
+}
+
+void Parser::release_tokens()
+{
+	while (m_buffer_start < m_index && m_buffer.size() > 1)
 	{
-		return (*m_tokens)[m_index - n];
+		m_buffer.pop_front();
+		++m_buffer_start;
 	}
-	return Token{ TokenType::EOF_TOKEN, {}, 0 };
 }
 
 /*
@@ -46,7 +72,7 @@ bool Parser::test(const std::initializer_list<std::function<bool()>>& test_funct
 		if (!result) 
 		{
 			m_index = saved_idx;
-			m_current_token = &(*m_tokens)[m_index];
+			m_current_token = &token_at(m_index);
 			return false; 
 		}
 	}
@@ -55,7 +81,7 @@ bool Parser::test(const std::initializer_list<std::function<bool()>>& test_funct
 }
 
 // Advance if the current token has TokenType type and is one of the listed values.
-bool Parser::consume(TokenType type, const std::initializer_list<std::string>& values)
+bool Parser::consume(TokenType type, const std::initializer_list<std::string_view>& values)
 {
 	for (const auto& v : values)
 	{
@@ -70,7 +96,7 @@ bool Parser::consume(TokenType type, const std::initializer_list<std::string>& v
 }
 
 //If the token was consumed then it will be pointed to by tok.
-bool Parser::consume(TokenType type, const std::initializer_list<std::string>& values, const Token*& tok)
+bool Parser::consume(TokenType type, const std::initializer_list<std::string_view>& values, const Token*& tok)
 {
 	bool result = consume(type, values);
 	if (result) tok = &prev();
@@ -105,33 +131,27 @@ bool Parser::test_parse(const std::function<Result<ASTNode*>()>& parse_fn, std::
 	return true;
 }
 
-Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> Parser::parse(const std::vector<Token>& tokens)
+Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> Parser::parse(const std::vector<Token>& tokens, std::shared_ptr<const void> source)
 {
-	m_tokens = &tokens;
-
-	m_index = 0;
-	m_current_token = &m_tokens->at(m_index);
+	size_t next = 0;
+	m_next_token = [&tokens, next]() mutable -> Result<Token> { return tokens.at(next++); };
+	m_source = std::move(source);
+	reset();
 
 	std::vector<Error> errors;
 	std::vector<std::unique_ptr<ASTNode>> stmts;
 
-	while (!consume(TokenType::EOF_TOKEN))
+	while (true)
 	{
-		Result<ASTNode*> res = parse_top_level();
+		auto res = parse_next();
 		if (res.is_error())
 		{
-			errors.push_back(res.get_error());
-
-			//If it's an error we will move to the next statement
-			//this is to ensure correct parsing and error reporting of future statements
-			while (m_current_token->is_not(TokenType::SPECIAL_CHAR, ";") && m_current_token->type != TokenType::EOF_TOKEN)
-				advance();
+			errors.insert(errors.end(), res.get_error().begin(), res.get_error().end());
+			continue;
 		}
-		else
-			stmts.emplace_back(*res);
-
-		if (!consume(TokenType::SPECIAL_CHAR, {";"} ))
-			errors.emplace_back("Expected ';' after statement", m_current_token->get_position());
+		if (!*res)
+			break;
+		stmts.push_back(std::move(*res));
 	}
 
 	if (!errors.empty()) 
@@ -139,8 +159,147 @@ Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> Parser::parse(
 	return stmts;
 }
 
+void Parser::start(Lexer& lexer, std::shared_ptr<const void> source)
+{
+	m_next_token = [&lexer]() { return lexer.next_token(); };
+	m_source = std::move(source);
+	reset();
+}
+
+void Parser::reset()
+{
+	m_buffer.clear();
+	m_buffer_start = 0;
+	m_reached_end = false;
+	m_lexer_error.reset();
+
+	m_index = 0;
+	m_current_token = &token_at(m_index);
+}
+
+Result<std::unique_ptr<ASTNode>, std::vector<Error>> Parser::parse_next()
+{
+	release_tokens();
+
+	if (consume(TokenType::EOF_TOKEN))
+	{
+		if (m_lexer_error)
+			return take_lexer_error();
+		return std::unique_ptr<ASTNode>();
+	}
+
+	std::vector<Error> errors;
+	std::unique_ptr<ASTNode> stmt;
+
+	Result<ASTNode*> res = parse_top_level();
+	if (res.is_error())
+	{
+		errors.push_back(res.get_error());
+
+		//If it's an error we will move to the next statement
+		//this is to ensure correct parsing and error reporting of future statements
+		while (m_current_token->is_not(TokenType::SPECIAL_CHAR, ";") && m_current_token->type != TokenType::EOF_TOKEN)
+			advance();
+	}
+	else
+		stmt.reset(*res);
+
+	if (!consume(TokenType::SPECIAL_CHAR, {";"} ))
+		errors.emplace_back("Expected ';' after statement", m_current_token->get_position());
+
+	if (!errors.empty())
+	{
+		//The statement ran into the end of the tokens produced before the lexer error
+		if (m_lexer_error)
+			return take_lexer_error();
+		return errors;
+	}
+	return stmt;
+}
+
+std::vector<Error> Parser::take_lexer_error()
+{
+	//Only reported once, the EOF token ends the statements afterwards
+	std::vector<Error> errors{ *m_lexer_error };
+	m_lexer_error.reset();
+	return errors;
+}
+
+//The "{" of the body has been consumed, skips to the matching "}"
+Result<ASTNode*> Parser::skim_function(const std::string& name, const std::vector<std::string>& arg_names)
+{
+	const Token& open = prev();
+	size_t depth = 1;
+	bool is_generator = false;
+	while (true)
+	{
+		if (m_current_token->type == TokenType::EOF_TOKEN)
+			return Error("Expected '}' after function body", m_current_token->get_position());
+
+		if (m_current_token->is(TokenType::SPECIAL_CHAR, "{"))
+			++depth;
+		else if (m_current_token->is(TokenType::SPECIAL_CHAR, "}") && --depth == 0)
+			break;
+		else if (m_current_token->is(TokenType::KEYWORD, "yield"))
+			is_generator = true;
+		advance();
+	}
+
+	//The body between the braces, the text of special characters points at them in the source
+	const char* body_begin = open.get_text().data() + 1;
+	std::string_view body(body_begin, m_current_token->get_text().data() - body_begin);
+	size_t position = open.get_position() + 1;
+	advance();
+
+	std::shared_ptr<const void> source = m_source;
+	std::shared_ptr<const Namespace> name_space = m_namespace;
+	auto parse_body = [body, position, source, name_space]()
+	{
+		Lexer lexer;
+		lexer.start(body, position);
+		Parser parser;
+		parser.set_namespace(name_space);
+		return parser.parse_body(lexer, source);
+	};
+	return new ASTFunctionNode(name, arg_names, parse_body, is_generator);
+}
+
+Result<ASTBlockNode*> Parser::parse_body(Lexer& lexer, std::shared_ptr<const void> source)
+{
+	start(lexer, source);
+
+	std::vector<std::unique_ptr<ASTNode>> stmts;
+	while (!consume(TokenType::EOF_TOKEN))
+	{
+		Result<ASTNode*> res = parse_stmt();
+		if (res.is_error())
+			return res.get_error();
+		stmts.emplace_back(*res);
+
+		if (!consume(TokenType::SPECIAL_CHAR, { ";" }))
+			return Error("Expected ';' after statement", m_current_token->get_position());
+	}
+	return new ASTBlockNode(std::move(stmts));
+}
+
+std::string Parser::qualify(std::string_view name) const
+{
+	std::string qualified(name);
+	if (m_namespace && m_namespace->names.count(qualified))
+		qualified.insert(0, m_namespace->prefix);
+	return qualified;
+}
+
 Result<ASTNode*> Parser::parse_top_level()
 {
+	//"import" STRING_LITERAL
+	if (consume(TokenType::KEYWORD, { "import" }))
+	{
+		if (!consume(TokenType::LITERAL) || prev().get_literal_type() != LiteralType::STRING)
+			return Error("Expected module path after 'import'", m_current_token->get_position());
+		return new ASTImportNode(std::string(prev().get_text()));
+	}
+
 	//"fn" IDENTIFIER "("
 	std::unique_ptr<ASTNode> let_expr;
 	const Token* identifier = nullptr;
@@ -154,11 +313,11 @@ Result<ASTNode*> Parser::parse_top_level()
 		std::vector<std::string> arg_names;
 		if (consume(TokenType::IDENTIFIER)) 
 		{
-			arg_names.push_back(prev().get_string("name"));
+			arg_names.push_back(std::string(prev().get_text()));
 			while (consume(TokenType::SPECIAL_CHAR, {","}))
 			{
 				if (consume(TokenType::IDENTIFIER))
-					arg_names.push_back(prev().get_string("name"));
+					arg_names.push_back(std::string(prev().get_text()));
 				else
 					return Error("Expected argument after ','", m_current_token->get_position());
 			}
@@ -173,6 +332,10 @@ Result<ASTNode*> Parser::parse_top_level()
 		//"{" (<stmt>;)* "}" //TODO Remove duplication
 		if (consume(TokenType::SPECIAL_CHAR, {"{"}))
 		{
+			if (m_lazy_functions && m_source)
+				return skim_function(qualify(identifier->get_text()), arg_names);
+
+			m_saw_yield = false;
 			std::vector<std::unique_ptr<ASTNode>> stmts;
 			while (!consume(TokenType::SPECIAL_CHAR, { "}" }))
 			{
@@ -185,11 +348,41 @@ Result<ASTNode*> Parser::parse_top_level()
 				if (!consume(TokenType::SPECIAL_CHAR, { ";" }))
 					return Error("Expected ';' after statement", m_current_token->get_position());
 			}
-			return new ASTFunctionNode(identifier->get_string("name"), arg_names, new ASTBlockNode(std::move(stmts)));
+			return new ASTFunctionNode(qualify(identifier->get_text()), arg_names, new ASTBlockNode(std::move(stmts)), m_saw_yield);
 		}
 		return Error("Function has no body", m_current_token->get_position());
 	}
 
+	//"struct" IDENTIFIER "{" (IDENTIFIER ("," IDENTIFIER)*)? "}"
+	const Token* struct_identifier = nullptr;
+	if (test({
+		[this]() { return consume(TokenType::KEYWORD, {"struct"}); },
+		[&]() { return consume(TokenType::IDENTIFIER, struct_identifier); },
+		[this]() { return consume(TokenType::SPECIAL_CHAR, {"{"}); }
+		}))
+	{
+		std::vector<std::string> field_names;
+		if (consume(TokenType::IDENTIFIER))
+		{
+			field_names.push_back(std::string(prev().get_text()));
+			while (consume(TokenType::SPECIAL_CHAR, {","}))
+			{
+				if (!consume(TokenType::IDENTIFIER))
+					return Error("Expected field after ','", m_current_token->get_position());
+
+				std::string field(prev().get_text());
+				if (std::find(field_names.begin(), field_names.end(), field) != field_names.end())
+					return Error("Duplicate field in struct", prev().get_position());
+				field_names.push_back(field);
+			}
+		}
+
+		if (!consume(TokenType::SPECIAL_CHAR, { "}" }))
+			return Error("Expected '}' after fields", m_current_token->get_position());
+
+		return new ASTStructNode(qualify(struct_identifier->get_text()), field_names);
+	}
+
 	return parse_stmt();
 }
 
@@ -223,6 +416,17 @@ Result<ASTNode*> Parser::parse_stmt()
 		return new ASTPrintNode(print_expr.release());
 	}
 
+	//"yield" <expr>
+	std::unique_ptr<ASTNode> yield_expr;
+	if (test({
+		[this]() { return consume(TokenType::KEYWORD, {"yield"}); },
+		[&]() { return test_parse(std::bind(&Parser::parse_expr, this), yield_expr); }
+		}))
+	{
+		m_saw_yield = true;
+		return new ASTYieldNode(yield_expr.release());
+	}
+
 	//"ret" <expr>?
 	if (consume(TokenType::KEYWORD, { "ret" })) 
 	{
@@ -242,7 +446,7 @@ Result<ASTNode*> Parser::parse_stmt()
 		[&]() { return test_parse(std::bind(&Parser::parse_expr, this), let_expr); }
 	}))
 	{
-		return new ASTLetNode(identifier->get_string("name"), let_expr.release());
+		return new ASTLetNode(std::string(identifier->get_text()), let_expr.release());
 	}
 
 	//IDENTIFIER ":=" <expr>
@@ -254,7 +458,33 @@ Result<ASTNode*> Parser::parse_stmt()
 		[&]() { return test_parse(std::bind(&Parser::parse_expr, this), assignment_expr); }
 		}))
 	{
-		return new ASTAssignmentNode(new ASTIdentifierNode(assignment_identifier->get_string("name")), assignment_expr.release());
+		return new ASTAssignmentNode(new ASTIdentifierNode(std::string(assignment_identifier->get_text())), assignment_expr.release());
+	}
+
+	//IDENTIFIER ("." IDENTIFIER)+ ":=" <expr>
+	std::unique_ptr<ASTFieldNode> field_target;
+	std::unique_ptr<ASTNode> field_expr;
+	if (test({
+		[this]() { return consume(TokenType::IDENTIFIER); },
+		[&]()
+		{
+			ASTNode* object = new ASTIdentifierNode(std::string(prev().get_text()));
+			while (consume(TokenType::SPECIAL_CHAR, { "." }))
+			{
+				if (!consume(TokenType::IDENTIFIER))
+					break;
+				object = new ASTFieldNode(object, std::string(prev().get_text()));
+			}
+			field_target.reset(dynamic_cast<ASTFieldNode*>(object));
+			if (!field_target)
+				delete object;
+			return field_target != nullptr;
+		},
+		[this]() { return consume(TokenType::OPERATOR, {":="}); },
+		[&]() { return test_parse(std::bind(&Parser::parse_expr, this), field_expr); }
+		}))
+	{
+		return new ASTFieldAssignmentNode(field_target.release(), field_expr.release());
 	}
 
 	//<if>
@@ -285,6 +515,7 @@ Result<ASTNode*> Parser::parse_stmt()
 	//"while" "(" <expr> ")" <stmt>
 	std::unique_ptr<ASTNode> while_conditional_expr;
 	std::unique_ptr<ASTNode> while_then_stmt;
+	size_t while_position = m_current_token->get_position();
 	if (test({
 		[this]() { return consume(TokenType::KEYWORD, {"while"}); },
 		[this]() { return consume(TokenType::SPECIAL_CHAR, {"("}); },
@@ -293,7 +524,7 @@ Result<ASTNode*> Parser::parse_stmt()
 		[&]() { return test_parse(std::bind(&Parser::parse_stmt, this), while_then_stmt); }
 		}))
 	{
-		return new ASTWhileNode(while_conditional_expr.release(), while_then_stmt.release());
+		return new ASTWhileNode(while_conditional_expr.release(), while_then_stmt.release(), while_position);
 	}
 
 	//<expr>
@@ -341,23 +572,28 @@ Result<ASTNode*> Parser::parse_product()
 */
 Result<ASTNode*> Parser::parse_binary_expr(const std::function<Result<ASTNode*>()>& parse_x,
 										   const std::function<Result<ASTNode*>()>& parse_y,
-										   const std::initializer_list<std::string>& operators)
+										   const std::initializer_list<std::string_view>& operators)
 {
+	//<x> is parsed once and shared by both alternatives, parsing it again for the second one
+	//makes the time exponential in the nesting depth of the expression
+	Result<ASTNode*> x_res = parse_x();
+	if (x_res.is_error())
+		return x_res;
+	std::unique_ptr<ASTNode> x_expr(*x_res);
+
 	//<x> "operator" <y>
-	std::unique_ptr<ASTNode> x_expr;
 	std::unique_ptr<ASTNode> y_expr;
 	const Token* op = nullptr;
 	if (test({
-		[&]() { return test_parse(parse_x, x_expr); },
 		[&]() { return consume(TokenType::OPERATOR, operators, op); },
 		[&]() { return test_parse(parse_y, y_expr); }
 		}))
 	{
-		return new ASTBinaryNode(op->get_string("value"), x_expr.release(), y_expr.release());
+		return new ASTBinaryNode(std::string(op->get_text()), x_expr.release(), y_expr.release());
 	}
 
 	//<x>
-	return parse_x();
+	return x_expr.release();
 }
 
 Result<ASTNode*> Parser::parse_unary()
@@ -372,8 +608,39 @@ Result<ASTNode*> Parser::parse_unary()
 		return new ASTUnaryNode("-", unary.release());
 	}
 
-	//<primary>
-	return parse_primary();
+	// "await" <unary>
+	std::unique_ptr<ASTNode> awaited;
+	if (test({
+		[this]() { return consume(TokenType::KEYWORD, {"await"}); },
+		[&]() { return test_parse(std::bind(&Parser::parse_unary, this), awaited); },
+	}))
+	{
+		return new ASTAwaitNode(awaited.release());
+	}
+
+	//<postfix>
+	return parse_postfix();
+}
+
+Result<ASTNode*> Parser::parse_postfix()
+{
+	//<primary> ("." IDENTIFIER)*
+	Result<ASTNode*> primary_res = parse_primary();
+	if (primary_res.is_error())
+		return primary_res;
+
+	ASTNode* object = *primary_res;
+	while (consume(TokenType::SPECIAL_CHAR, { "." }))
+	{
+		if (!consume(TokenType::IDENTIFIER))
+		{
+			delete object;
+			return Error("Expected field name after '.'", m_current_token->get_position());
+		}
+		object = new ASTFieldNode(object, std::string(prev().get_text()));
+	}
+
+	return object;
 }
 
 Result<ASTNode*> Parser::parse_primary()
@@ -381,17 +648,21 @@ Result<ASTNode*> Parser::parse_primary()
 	// LITERAL
 	if (consume(TokenType::LITERAL))
 	{
-		if (prev().get_string("data_type") == "integer")
-			return new ASTLiteralNode(prev().get_int("value"));
-
-		if (prev().get_string("data_type") == "float")
-			return new ASTLiteralNode(prev().get_float("value"));
-
-		if (prev().get_string("data_type") == "char")
-			return new ASTLiteralNode(prev().get_char("value"));
-
-		if (prev().get_string("data_type") == "string")
-			return new ASTLiteralNode(prev().get_string("value"));
+		switch (prev().get_literal_type())
+		{
+		case LiteralType::INTEGER:
+			return new ASTLiteralNode(prev().get_int());
+		case LiteralType::FLOAT:
+			return new ASTLiteralNode(prev().get_float());
+		case LiteralType::CHAR:
+			return new ASTLiteralNode(prev().get_char());
+		case LiteralType::STRING:
+			//String literals reference the source instead of copying it when the source has an owner
+			return new ASTLiteralNode(prev().get_text(), m_source);
+		case LiteralType::NONE:
+			break;
+		}
+		return Error("Literal has no type", prev().get_position());
 	}
 
 	//"input"
@@ -400,12 +671,45 @@ Result<ASTNode*> Parser::parse_primary()
 		return new ASTInputNode;
 	}
 
-	//IDENTIFIER "("
+	//"spawn" IDENTIFIER "(" (<expr> ("," <expr>)*)? ")"
+	if (consume(TokenType::KEYWORD, { "spawn" }))
+	{
+		size_t spawn_position = prev().get_position();
+		Result<ASTNode*> call_res = parse_primary();
+		if (call_res.is_error())
+			return call_res;
+
+		if (auto* call = dynamic_cast<ASTCallNode*>(*call_res))
+			return new ASTSpawnNode(call);
+
+		delete *call_res;
+		return Error("Expected function call after 'spawn'", spawn_position);
+	}
+
+	//IDENTIFIER "." IDENTIFIER "(", a function of an imported module
+	std::string call_name;
+	const Token* call_module = nullptr;
 	const Token* call_fn = nullptr;
 	if (test({
+		[&]() { return consume(TokenType::IDENTIFIER, call_module); },
+		[this]() { return consume(TokenType::SPECIAL_CHAR, {"."}); },
 		[&]() { return consume(TokenType::IDENTIFIER, call_fn); },
 		[this]() { return consume(TokenType::SPECIAL_CHAR, {"("}); }
 		}))
+	{
+		call_name = std::string(call_module->get_text()) + "." + std::string(call_fn->get_text());
+	}
+
+	//IDENTIFIER "("
+	else if (test({
+		[&]() { return consume(TokenType::IDENTIFIER, call_fn); },
+		[this]() { return consume(TokenType::SPECIAL_CHAR, {"("}); }
+		}))
+	{
+		call_name = qualify(call_fn->get_text());
+	}
+
+	if (!call_name.empty())
 	{
 		//(<expr> ("," <expr>)*)?
 		std::vector<std::unique_ptr<ASTNode>> args;
@@ -432,24 +736,24 @@ Result<ASTNode*> Parser::parse_primary()
 			return Error("Expected ')' after arguments", m_current_token->get_position());
 		}
 
-		return new ASTCallNode(call_fn->get_string("name"), std::move(args));
+		return new ASTCallNode(call_name, std::move(args));
 	}
 
 	// IDENTIFIER
 	if (consume(TokenType::IDENTIFIER))
-		return new ASTIdentifierNode(prev().get_string("name"));
+		return new ASTIdentifierNode(std::string(prev().get_text()));
 	
-	// "(" TYPE ")" <primary>
+	// "(" TYPE ")" <postfix>
 	std::unique_ptr<ASTNode> casted_primary;
 	const Token* type_token = nullptr;
 	if (test({
 		[this]() { return consume(TokenType::SPECIAL_CHAR, {"("}); },
 		[&]() { return consume(TokenType::TYPE, type_token); },
 		[this]() { return consume(TokenType::SPECIAL_CHAR, {")"}); },
-		[&]() { return test_parse(std::bind(&Parser::parse_primary, this), casted_primary); }
+		[&]() { return test_parse(std::bind(&Parser::parse_postfix, this), casted_primary); }
 		}))
 	{
-		return new ASTCastNode(type_token->get_string("value"), casted_primary.release());
+		return new ASTCastNode(std::string(type_token->get_text()), casted_primary.release());
 	}
 
 	// "(" <expr> ")"
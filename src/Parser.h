@@ -1,7 +1,11 @@
 #pragma once
 
+#include <deque>
 #include <functional>
+#include <optional>
+#include <unordered_set>
 
+#include "Lexer.h"
 #include "Token.h"
 #include "Result.h"
 #include "AST.h"
@@ -9,21 +13,71 @@
 class Parser
 {
 public:
+	/*
+	* The functions and structs a module declares at the top level, see ModuleLoader. Their declarations and
+	* the calls to them inside the module are prefixed with the namespace of the module.
+	*/
+	struct Namespace
+	{
+		std::string prefix;
+		std::unordered_set<std::string> names;
+	};
+
 	Parser();
-	Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> parse(const std::vector<Token>& tokens);
+	/*
+	* "source" owns the source code the tokens reference. String literals reference it instead of copying their
+	* contents when it is given, otherwise the source only has to outlive the call.
+	*/
+	Result<std::vector<std::unique_ptr<ASTNode>>, std::vector<Error>> parse(const std::vector<Token>& tokens, std::shared_ptr<const void> source = nullptr);
+
+	/*
+	* Streaming mode, the tokens are pulled from "lexer" (which has to be started on the source) as the
+	* parser needs them and released again once the statement they belong to is parsed.
+	*/
+	void start(Lexer& lexer, std::shared_ptr<const void> source = nullptr);
+
+	/*
+	* Parses the next top level statement, returns nullptr after the last one.
+	* On errors the parser skips to the next statement so it can be called again to find the following errors.
+	* A lexer error ends the statements, it is returned instead of the errors it causes in the parser.
+	*/
+	Result<std::unique_ptr<ASTNode>, std::vector<Error>> parse_next();
+
+	/*
+	* Function bodies are only skimmed to find their end and parsed when the function is first called,
+	* so syntax errors in them are reported by the call. Only used when the parser is given a source
+	* owner, the bodies are parsed again from the source.
+	*/
+	inline void set_lazy_functions(bool lazy_functions) { m_lazy_functions = lazy_functions; }
+
+	inline void set_namespace(std::shared_ptr<const Namespace> name_space) { m_namespace = std::move(name_space); }
+
+	//Parses the statements of a function body up to the end of the tokens, used for lazily parsed functions
+	Result<ASTBlockNode*> parse_body(Lexer& lexer, std::shared_ptr<const void> source);
 private:
 	void advance();
 	const Token& prev(size_t n = 1);
 
+	//The token at absolute index "index", the EOF token past the end
+	const Token& token_at(size_t index);
+	void reset();
+	std::vector<Error> take_lexer_error();
+	//Drops the buffered tokens before the current one, the parser never goes back past a statement
+	void release_tokens();
+
 	bool test(const std::initializer_list<std::function<bool()>>& test_functions);
 
-	bool consume(TokenType type, const std::initializer_list<std::string>& values);
+	bool consume(TokenType type, const std::initializer_list<std::string_view>& values);
 	bool consume(TokenType type);
-	bool consume(TokenType type, const std::initializer_list<std::string>& values, const Token*& tok);
+	bool consume(TokenType type, const std::initializer_list<std::string_view>& values, const Token*& tok);
 	bool consume(TokenType type, const Token*& tok);
 	bool test_parse(const std::function<Result<ASTNode*>()>& parse_fn, std::unique_ptr<ASTNode>& result);
 
+	//Prefixes the names declared by the module being parsed with its namespace
+	std::string qualify(std::string_view name) const;
+
 	Result<ASTNode*> parse_top_level();
+	Result<ASTNode*> skim_function(const std::string& name, const std::vector<std::string>& arg_names);
 
 	Result<ASTNode*> parse_stmt();
 	Result<ASTNode*> parse_expr();
@@ -34,12 +88,25 @@ private:
 	Result<ASTNode*> parse_product();
 	Result<ASTNode*> parse_binary_expr(const std::function<Result<ASTNode*>()>& parse_x, 
 									   const std::function<Result<ASTNode*>()>& parse_y, 
-									   const std::initializer_list<std::string>& operators);
+									   const std::initializer_list<std::string_view>& operators);
 
 	Result<ASTNode*> parse_unary();
+	Result<ASTNode*> parse_postfix();
 	Result<ASTNode*> parse_primary();
 
-	const std::vector<Token>* m_tokens;
+	//Tokens [m_buffer_start, m_buffer_start + m_buffer.size()), references stay valid while tokens are added and removed
+	std::deque<Token> m_buffer;
+	size_t m_buffer_start = 0;
+	std::function<Result<Token>()> m_next_token;
+	bool m_reached_end = false;
+	std::optional<Error> m_lexer_error;
+
+	std::shared_ptr<const void> m_source;
 	size_t m_index;
 	const Token* m_current_token;
+
+	//Set when a yield statement is parsed, used to mark the enclosing function as a generator
+	bool m_saw_yield = false;
+	bool m_lazy_functions = false;
+	std::shared_ptr<const Namespace> m_namespace;
 };
\ No newline at end of file
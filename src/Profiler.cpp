@@ -0,0 +1,142 @@
+#include "Profiler.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <set>
+#include <unordered_map>
+
+#include "AST.h"
+
+Profiler::Profiler(std::chrono::microseconds interval)
+	: m_interval(std::max<Clock::duration>(interval, std::chrono::microseconds(1)))
+{}
+
+void Profiler::add_source(const std::string& prefix, std::string_view text)
+{
+	std::vector<size_t> lines{ 0 };
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+		if (text[i] == '\n')
+			lines.push_back(i + 1);
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_lines[prefix] = std::move(lines);
+}
+
+void Profiler::sample(const Stack& stack, Clock::time_point& next_sample)
+{
+	Clock::time_point now = Clock::now();
+	if (now < next_sample)
+		return;
+
+	//A stack which ran for several intervals without a check gets all of their samples
+	uint64_t n_samples = 1 + static_cast<uint64_t>((now - next_sample) / m_interval);
+	next_sample += n_samples * m_interval;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_samples[stack] += n_samples;
+}
+
+size_t Profiler::line_of(const std::string& prefix, size_t position) const
+{
+	auto lines_it = m_lines.find(prefix);
+	if (lines_it == m_lines.end())
+		return 0;
+	const std::vector<size_t>& lines = lines_it->second;
+	return std::upper_bound(lines.begin(), lines.end(), position) - lines.begin();
+}
+
+std::string Profiler::label(const Stack& stack, size_t index) const
+{
+	if (auto* function = dynamic_cast<const ASTFunctionNode*>(stack[index]))
+		return function->get_name();
+
+	//Loops are named by their line in the source of the function around them, or of the program at the top level
+	auto* loop = static_cast<const ASTWhileNode*>(stack[index]);
+	std::string prefix;
+	for (size_t i = index; i-- > 0;)
+	{
+		if (auto* function = dynamic_cast<const ASTFunctionNode*>(stack[i]))
+		{
+			const std::string& name = function->get_name();
+			size_t dot = name.rfind('.');
+			if (dot != std::string::npos)
+				prefix = name.substr(0, dot + 1);
+			break;
+		}
+	}
+
+	size_t line = line_of(prefix, loop->get_position());
+	if (line == 0)
+		return "while";
+	std::string module = prefix.empty() ? "" : prefix.substr(0, prefix.size() - 1) + ":";
+	return "while@" + module + std::to_string(line);
+}
+
+void Profiler::write_collapsed(std::ostream& out) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	//Different loops can get the same label, their stacks are merged
+	std::map<std::string, uint64_t> collapsed;
+	for (const auto& [stack, n_samples] : m_samples)
+	{
+		std::string line = "main";
+		for (size_t i = 0; i < stack.size(); ++i)
+			line += ";" + label(stack, i);
+		collapsed[line] += n_samples;
+	}
+
+	for (const auto& [line, n_samples] : collapsed)
+		out << line << ' ' << n_samples << '\n';
+}
+
+void Profiler::write_top(std::ostream& out, size_t n) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	struct Frame
+	{
+		uint64_t self = 0;
+		uint64_t total = 0;
+	};
+	std::unordered_map<std::string, Frame> frames;
+	uint64_t n_total = 0;
+	for (const auto& [stack, n_samples] : m_samples)
+	{
+		n_total += n_samples;
+		frames[stack.empty() ? "main" : label(stack, stack.size() - 1)].self += n_samples;
+
+		//Recursive frames only count once per sample
+		std::set<std::string> seen{ "main" };
+		for (size_t i = 0; i < stack.size(); ++i)
+			seen.insert(label(stack, i));
+		for (const std::string& name : seen)
+			frames[name].total += n_samples;
+	}
+
+	std::vector<std::pair<std::string, Frame>> sorted(frames.begin(), frames.end());
+	std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b)
+	{
+		if (a.second.self != b.second.self)
+			return a.second.self > b.second.self;
+		return a.second.total > b.second.total;
+	});
+	if (sorted.size() > n)
+		sorted.resize(n);
+
+	double interval_ms = std::chrono::duration<double, std::milli>(m_interval).count();
+	out << "profile: " << n_total << " samples every " << interval_ms << " ms" << '\n';
+	if (n_total == 0)
+		return;
+
+	out << "profile: " << std::setw(8) << "self" << std::setw(8) << "self%" << std::setw(8) << "total" << std::setw(8) << "total%" << "  frame" << '\n';
+	out << std::fixed << std::setprecision(1);
+	for (const auto& [name, frame] : sorted)
+	{
+		out << "profile: " << std::setw(8) << frame.self << std::setw(7) << 100.0 * frame.self / n_total << '%'
+			<< std::setw(8) << frame.total << std::setw(7) << 100.0 * frame.total / n_total << '%' << "  " << name << '\n';
+	}
+	out << std::defaultfloat;
+}
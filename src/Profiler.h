@@ -0,0 +1,58 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class ASTNode;
+
+/*
+* Sampling profiler for scripts. The interpreters keep a stack of the functions and loops they are running and
+* check the clock every few hundred steps (see Interpreter::take_step), each interval which passed since their last
+* sample adds one sample of their current stack. Samples are only taken between steps, time spent in a long builtin
+* is counted when it returns. An interpreter and its workers share one profiler.
+*/
+class Profiler
+{
+public:
+	using Clock = std::chrono::steady_clock;
+	using Stack = std::vector<const ASTNode*>;
+
+	//Steps between two checks of the clock, a check costs about as much as a step
+	static constexpr uint64_t steps_per_check = 256;
+
+	explicit Profiler(std::chrono::microseconds interval = std::chrono::milliseconds(1));
+
+	/*
+	* Registers the source of the program ("prefix" is empty) or of a module ("prefix" is its namespace) so loops
+	* are named by their line. Positions of nodes are looked up in the source of the function they are in.
+	*/
+	void add_source(const std::string& prefix, std::string_view text);
+
+	inline Clock::time_point first_sample() const { return Clock::now() + m_interval; }
+
+	//Samples "stack" once for every interval since "next_sample" and moves it past now
+	void sample(const Stack& stack, Clock::time_point& next_sample);
+
+	//One line per stack, the frames from the outermost separated by ';' and the number of samples (flamegraph.pl)
+	void write_collapsed(std::ostream& out) const;
+
+	//The "n" frames with the most samples of their own, with the samples of everything they called
+	void write_top(std::ostream& out, size_t n) const;
+
+private:
+	std::string label(const Stack& stack, size_t index) const;
+	size_t line_of(const std::string& prefix, size_t position) const;
+
+	const Clock::duration m_interval;
+
+	mutable std::mutex m_mutex;
+	std::map<Stack, uint64_t> m_samples;
+	//The offsets at which the lines of each source start, by prefix
+	std::map<std::string, std::vector<size_t>> m_lines;
+};
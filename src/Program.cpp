@@ -0,0 +1,48 @@
+#include "Program.h"
+#include "ASTCache.h"
+#include "MappedFile.h"
+#include "ParallelParser.h"
+
+Result<std::shared_ptr<const Program>, std::vector<Error>> Program::load(const std::string& path, const Options& options, ThreadPool& pool)
+{
+	std::shared_ptr<MappedFile> source = MappedFile::open(path);
+	if (!source)
+		return std::vector<Error>{ Error("Cannot open file", 0) };
+
+	std::string_view text = source->view();
+	return parse(std::move(source), text, path, options, pool);
+}
+
+Result<std::shared_ptr<const Program>, std::vector<Error>> Program::parse(std::shared_ptr<const void> source, std::string_view text,
+	const std::string& path, const Options& options, ThreadPool& pool)
+{
+	std::shared_ptr<Program> program(new Program);
+	program->m_source = std::move(source);
+	program->m_text = text;
+	program->m_path = path;
+	program->m_options = options;
+
+	//A cached program replaces lexing and parsing
+	std::unique_ptr<ASTCache> cache;
+	if (options.use_cache && !path.empty())
+	{
+		cache = std::make_unique<ASTCache>(path, options.cache_dir, text);
+		auto cache_res = cache->load();
+		if (!cache_res.is_error())
+		{
+			program->m_statements = std::move(*cache_res);
+			return std::shared_ptr<const Program>(std::move(program));
+		}
+	}
+
+	ParallelParser parser(pool);
+	parser.set_lazy_functions(options.lazy_functions);
+	auto parser_res = parser.parse(text, program->m_source);
+	if (parser_res.is_error())
+		return parser_res.get_error();
+
+	program->m_statements = std::move(*parser_res);
+	if (cache)
+		cache->store(program->m_statements);
+	return std::shared_ptr<const Program>(std::move(program));
+}
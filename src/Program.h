@@ -0,0 +1,52 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "AST.h"
+#include "Error.h"
+#include "Result.h"
+#include "ThreadPool.h"
+
+/*
+* A parsed program. A program never changes once it is parsed, so any number of contexts can run it at the
+* same time on different threads (see Context). It keeps its source alive since the tree references it.
+*/
+class Program
+{
+public:
+	struct Options
+	{
+		//See Parser::set_lazy_functions
+		bool lazy_functions = false;
+		//Load the program from its cache and write the cache after parsing, see ASTCache. Modules are always cached
+		bool use_cache = false;
+		std::string cache_dir;
+	};
+
+	//Maps the file at "path" and parses it on "pool"
+	static Result<std::shared_ptr<const Program>, std::vector<Error>> load(const std::string& path, const Options& options, ThreadPool& pool);
+
+	/*
+	* Parses "text" on "pool", "source" keeps the text alive. "path" is the file the text was read from, the cache is
+	* named after it and relative imports are resolved against its directory. It is empty for text which isn't a file.
+	*/
+	static Result<std::shared_ptr<const Program>, std::vector<Error>> parse(std::shared_ptr<const void> source, std::string_view text,
+		const std::string& path, const Options& options, ThreadPool& pool);
+
+	inline const std::vector<std::unique_ptr<ASTNode>>& get_statements() const { return m_statements; }
+	inline std::string_view get_text() const { return m_text; }
+	inline const std::string& get_path() const { return m_path; }
+	inline const Options& get_options() const { return m_options; }
+
+private:
+	Program() = default;
+
+	std::shared_ptr<const void> m_source;
+	std::string_view m_text;
+	std::string m_path;
+	Options m_options;
+	std::vector<std::unique_ptr<ASTNode>> m_statements;
+};
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <new>
+#include <utility>
+
 #include "Error.h"
 
 template <typename T, typename E = Error>
@@ -16,13 +19,28 @@ public:
     {
         if (!b_has_value) return;
 
+        //The union members are not constructed yet so they can't be assigned to
+        if (b_error)
+            new (&error) E(other.error);
+        else
+            new (&value) T(other.value);
+    }
+
+    //Moving avoids touching the reference count when a shared_ptr result is passed up
+    Result(Result&& other)
+        : b_error(other.b_error)
+        , b_has_value(other.b_has_value)
+    {
+        if (!b_has_value) return;
+
         if (b_error)
-            error = std::move(other.error);
+            new (&error) E(std::move(other.error));
         else
-            value = std::move(other.value);
+            new (&value) T(std::move(other.value));
     }
 
     inline const T& operator*() const { return value; }
+    inline T& operator*() { return value; }
     inline const E& get_error() const { return error; }
 
     bool is_error() const { return b_error; }
@@ -39,7 +57,7 @@ public:
     }
 
 private:
-    const union
+    union
     {
         T value;
         E error;
@@ -1,4 +1,5 @@
 #include "ScopeManager.h"
+#include "Stats.h"
 
 std::shared_ptr<Value>* ScopeManager::get_variable(const std::string& name)
 {
@@ -9,20 +10,29 @@ std::shared_ptr<Value>* ScopeManager::get_variable(const std::string& name)
 			return &vars_it->second;
 	}
 
+	if (m_globals)
+	{
+		auto vars_it = m_globals->find(name);
+		if (vars_it != m_globals->end())
+			return &vars_it->second;
+	}
+
 	return nullptr;
 }
 
 void ScopeManager::add_variable(const std::string& name, std::shared_ptr<Value> value)
 {
-	m_scopes.back()[name] = value;
+	m_scopes.back()[name] = std::move(value);
 }
 
 void ScopeManager::push_scope()
 {
 	m_scopes.emplace_back();
+	STATS_SCOPE_PUSH();
 }
 
 void ScopeManager::pop_scope()
 {
 	m_scopes.pop_back();
+	STATS_SCOPE_POP();
 }
\ No newline at end of file
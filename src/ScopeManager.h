@@ -14,6 +14,18 @@ public:
 	void add_variable(const std::string& name, std::shared_ptr<Value> value);
 	void push_scope();
 	void pop_scope();
+
+	inline const std::unordered_map<std::string, std::shared_ptr<Value>>& get_global_scope() const { return m_globals ? *m_globals : m_scopes.front(); }
+	inline const std::vector<std::unordered_map<std::string, std::shared_ptr<Value>>>& get_scopes() const { return m_scopes; }
+
+	/*
+	* Variables not found in our scopes are looked up in "globals", nullptr unlinks them. Generators run on scopes
+	* of their own and link the global scope of the interpreter resuming them for as long as they run.
+	*/
+	inline void link_globals(std::unordered_map<std::string, std::shared_ptr<Value>>* globals) { m_globals = globals; }
+	//The linked global scope if there is one, otherwise our outermost scope (see get_global_scope)
+	inline std::unordered_map<std::string, std::shared_ptr<Value>>& get_globals() { return m_globals ? *m_globals : m_scopes.front(); }
 private:
 	std::vector<std::unordered_map<std::string, std::shared_ptr<Value>>> m_scopes;
+	std::unordered_map<std::string, std::shared_ptr<Value>>* m_globals = nullptr;
 };
\ No newline at end of file
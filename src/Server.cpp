@@ -0,0 +1,470 @@
+#include "Server.h"
+#include "ASTCache.h"
+#include "Context.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <thread>
+
+#ifdef _WIN32
+#include <io.h>
+#define read _read
+#define write _write
+#else
+#include <csignal>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+//Programs are parsed again once this many other programs were used after them
+static constexpr size_t max_programs = 256;
+//Larger sources and inputs are refused, the payloads are read into memory before the request runs
+static constexpr size_t max_payload_size = 64 * 1024 * 1024;
+//Longer header lines are invalid, a client which never ends the line can't make the server buffer it forever
+static constexpr size_t max_header_size = 64 * 1024;
+
+static int64_t microseconds_since(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+Connection::Connection(int in_fd, int out_fd)
+	: m_in(in_fd)
+	, m_out(out_fd)
+	, m_buffer(1 << 16)
+{}
+
+bool Connection::read_line(std::string& line, size_t max_size)
+{
+	line.clear();
+	while (true)
+	{
+		const char* begin = m_buffer.data() + m_pos;
+		const char* newline = static_cast<const char*>(std::memchr(begin, '\n', m_size - m_pos));
+		if (newline)
+		{
+			line.append(begin, newline);
+			m_pos = newline - m_buffer.data() + 1;
+			return true;
+		}
+
+		line.append(begin, m_size - m_pos);
+		m_pos = m_size;
+		if (line.size() > max_size)
+			return true;
+		if (!fill())
+			return false;
+	}
+}
+
+bool Connection::read_exact(std::string& data, size_t size)
+{
+	data.clear();
+	while (data.size() < size)
+	{
+		if (m_pos == m_size && !fill())
+			return false;
+
+		size_t n = std::min(size - data.size(), m_size - m_pos);
+		data.append(m_buffer.data() + m_pos, n);
+		m_pos += n;
+	}
+	return true;
+}
+
+bool Connection::write_all(std::string_view data)
+{
+	while (!data.empty())
+	{
+		auto n_written = write(m_out, data.data(), static_cast<unsigned>(data.size()));
+		if (n_written <= 0)
+			return false;
+		data.remove_prefix(static_cast<size_t>(n_written));
+	}
+	return true;
+}
+
+bool Connection::fill()
+{
+	m_pos = 0;
+	m_size = 0;
+	auto n_read = read(m_in, m_buffer.data(), static_cast<unsigned>(m_buffer.size()));
+	if (n_read <= 0)
+		return false;
+	m_size = static_cast<size_t>(n_read);
+	return true;
+}
+
+Server::Server(const Options& options)
+	: m_options(options)
+{}
+
+int Server::serve_stdin()
+{
+	//Scripts recurse on the native stack, see Interpreter::stack_size
+	run_on_stack(Interpreter::stack_size(m_options.max_depth), [this]()
+	{
+		Connection connection(0, 1);
+		serve_connection(connection);
+	});
+	return 0;
+}
+
+int Server::serve_socket(const std::string& path)
+{
+#ifdef _WIN32
+	std::cout << "Unix domain sockets are not supported on this platform, use --serve -" << std::endl;
+	return -1;
+#else
+	//A client which disconnects early must not kill the server
+	std::signal(SIGPIPE, SIG_IGN);
+
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Socket path is too long: " << path << std::endl;
+		return -1;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+	//A socket file left behind by a previous server would make bind fail
+	unlink(path.c_str());
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listener < 0 || bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listener, 128) != 0)
+	{
+		std::cout << "Cannot listen on socket: " << path << std::endl;
+		return -1;
+	}
+
+	//Every connection is read on its own thread, the number of requests running at once is limited by the pools
+	while (true)
+	{
+		int client = accept(listener, nullptr, nullptr);
+		if (client < 0)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+			break;
+		}
+
+		StackThread(Interpreter::stack_size(m_options.max_depth), [this, client]()
+		{
+			Connection connection(client, client);
+			serve_connection(connection);
+			close(client);
+		}).detach();
+	}
+
+	//Connection threads may still be running, the process ends with them
+	std::cout << "Cannot accept connections on socket: " << path << std::endl;
+	std::_Exit(-1);
+#endif
+}
+
+std::unique_ptr<ThreadPool> Server::acquire_pool()
+{
+	std::unique_lock<std::mutex> lock(m_pools_mutex);
+	m_pool_released.wait(lock, [this]() { return !m_idle_pools.empty() || m_n_pools < std::max<size_t>(m_options.n_workers, 1); });
+	if (m_idle_pools.empty())
+	{
+		++m_n_pools;
+		return std::make_unique<ThreadPool>(m_options.n_threads, Interpreter::stack_size(m_options.max_depth));
+	}
+
+	std::unique_ptr<ThreadPool> pool = std::move(m_idle_pools.back());
+	m_idle_pools.pop_back();
+	return pool;
+}
+
+void Server::release_pool(std::unique_ptr<ThreadPool> pool)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_pools_mutex);
+		m_idle_pools.push_back(std::move(pool));
+	}
+	m_pool_released.notify_one();
+}
+
+void Server::serve_connection(Connection& connection)
+{
+	std::string header;
+	Request request;
+	while (connection.read_line(header, max_header_size))
+	{
+		Response response;
+		const char* error = read_request(connection, header, request);
+		if (error)
+		{
+			response.status = -1;
+			response.output = error;
+		}
+		else
+		{
+			//The pool is only taken once the whole request arrived, a client which stalls halfway through holds none
+			std::unique_ptr<ThreadPool> pool = acquire_pool();
+			auto start = std::chrono::steady_clock::now();
+			auto program_res = request.eval ? load_source(std::move(request.source), *pool) : load_script(request.path, *pool);
+			response.parse_us = microseconds_since(start);
+			if (program_res.is_error())
+			{
+				response.status = -1;
+				response.output = program_res.get_error();
+			}
+			else
+			{
+				auto run_start = std::chrono::steady_clock::now();
+				run(*program_res, request.input, *pool, response.output);
+				response.run_us = microseconds_since(run_start);
+			}
+			release_pool(std::move(pool));
+		}
+
+		std::string response_header = std::to_string(response.status) + " " + std::to_string(response.parse_us) + " " +
+			std::to_string(response.run_us) + " " + std::to_string(response.output.size()) + "\n";
+		if (!connection.write_all(response_header) || !connection.write_all(response.output))
+			return;
+
+		//After a malformed request the rest of the stream can't be split into requests
+		if (error)
+			return;
+	}
+}
+
+const char* Server::read_request(Connection& connection, const std::string& header, Request& request)
+{
+	char* end = nullptr;
+	request.path.clear();
+	request.source.clear();
+	if (header.size() > max_header_size)
+		return "Invalid request\n";
+	if (header.rfind("RUN ", 0) == 0)
+	{
+		size_t input_size = std::strtoull(header.c_str() + 4, &end, 10);
+		if (*end != ' ')
+			return "Invalid request\n";
+		if (input_size > max_payload_size)
+			return "Request too large\n";
+		if (!connection.read_exact(request.input, input_size))
+			return "Invalid request\n";
+
+		request.eval = false;
+		request.path = end + 1;
+		return nullptr;
+	}
+	if (header.rfind("EVAL ", 0) == 0)
+	{
+		size_t source_size = std::strtoull(header.c_str() + 5, &end, 10);
+		size_t input_size = std::strtoull(end, &end, 10);
+		if (*end != '\0')
+			return "Invalid request\n";
+		if (source_size > max_payload_size || input_size > max_payload_size)
+			return "Request too large\n";
+		if (!connection.read_exact(request.source, source_size) || !connection.read_exact(request.input, input_size))
+			return "Invalid request\n";
+
+		request.eval = true;
+		return nullptr;
+	}
+	return "Invalid request\n";
+}
+
+Result<std::shared_ptr<const Program>, std::string> Server::load_script(const std::string& path, ThreadPool& pool)
+{
+	//The size and modification time tell whether the parsed program is still current
+	std::error_code error;
+	uintmax_t size = std::filesystem::file_size(path, error);
+	auto version = std::filesystem::last_write_time(path, error).time_since_epoch().count();
+	if (error)
+		return std::string("Cannot open file: " + path + "\n");
+
+	Entry cached = find(path);
+	if (cached.program && cached.program->get_text().size() == size && cached.version == version)
+		return cached.program;
+
+	std::shared_ptr<MappedFile> source = MappedFile::open(path);
+	if (!source)
+		return std::string("Cannot open file: " + path + "\n");
+
+	std::string_view text = source->view();
+	auto parse_res = parse(std::move(source), text, path, pool);
+	if (parse_res.is_error())
+		return parse_res.get_error();
+	return remember(path, std::move(*parse_res), version);
+}
+
+Result<std::shared_ptr<const Program>, std::string> Server::load_source(std::string source, ThreadPool& pool)
+{
+	char name[32];
+	std::snprintf(name, sizeof(name), "eval:%016llx", static_cast<unsigned long long>(ASTCache::hash(source)));
+	std::string key = name;
+
+	Entry cached = find(key);
+	if (cached.program && cached.program->get_text() == source)
+		return cached.program;
+
+	auto text = std::make_shared<const std::string>(std::move(source));
+	auto parse_res = parse(text, *text, {}, pool);
+	if (parse_res.is_error())
+		return parse_res.get_error();
+	return remember(key, std::move(*parse_res));
+}
+
+Result<std::shared_ptr<const Program>, std::string> Server::parse(std::shared_ptr<const void> source, std::string_view text,
+	const std::string& path, ThreadPool& pool)
+{
+	//With a cache on disk a restarted server doesn't parse the scripts again either, sources without a path aren't cached
+	Program::Options options;
+	options.lazy_functions = m_options.lazy_functions;
+	options.use_cache = m_options.use_cache;
+	options.cache_dir = m_options.cache_dir;
+
+	auto program_res = Program::parse(std::move(source), text, path, options, pool);
+	if (program_res.is_error())
+	{
+		std::string errors;
+		for (const auto& err : program_res.get_error())
+			errors += std::string(err.message) + " at: " + std::to_string(err.position) + "\n";
+		return errors;
+	}
+	return std::move(*program_res);
+}
+
+Server::Entry Server::find(const std::string& key)
+{
+	std::lock_guard<std::mutex> lock(m_programs_mutex);
+	auto it = m_programs.find(key);
+	if (it == m_programs.end())
+		return Entry();
+
+	m_recent.splice(m_recent.begin(), m_recent, it->second.recent);
+	return it->second;
+}
+
+std::shared_ptr<const Program> Server::remember(const std::string& key, std::shared_ptr<const Program> program, int64_t version)
+{
+	//Requests still running an evicted program keep it alive
+	std::lock_guard<std::mutex> lock(m_programs_mutex);
+	auto it = m_programs.find(key);
+	if (it != m_programs.end())
+	{
+		it->second.program = program;
+		it->second.version = version;
+		m_recent.splice(m_recent.begin(), m_recent, it->second.recent);
+		return program;
+	}
+
+	if (m_programs.size() >= max_programs)
+	{
+		m_programs.erase(m_recent.back());
+		m_recent.pop_back();
+	}
+	m_recent.push_front(key);
+	m_programs.emplace(key, Entry{ program, version, m_recent.begin() });
+	return program;
+}
+
+void Server::run(const std::shared_ptr<const Program>& program, std::string_view input, ThreadPool& pool, std::string& output_text)
+{
+	//The context waits for spawned tasks which were never awaited, they still write to this request's output
+	OutputBuffer output(output_text);
+	InputBuffer input_buffer(input);
+	Context context(program, output, input_buffer, pool);
+	context.get_interpreter().set_max_depth(m_options.max_depth);
+	context.get_interpreter().set_limits(m_options.limits);
+	context.run();
+}
+
+int Server::load_test(const std::string& socket_path, const std::string& script_path, size_t n_requests, size_t n_clients)
+{
+#ifdef _WIN32
+	std::cout << "Unix domain sockets are not supported on this platform" << std::endl;
+	return -1;
+#else
+	std::signal(SIGPIPE, SIG_IGN);
+	n_clients = std::max<size_t>(n_clients, 1);
+
+	//The server resolves the path relative to its own directory
+	std::string request = "RUN 0 " + std::filesystem::absolute(script_path).string() + "\n";
+
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	if (socket_path.size() >= sizeof(address.sun_path))
+	{
+		std::cout << "Socket path is too long: " << socket_path << std::endl;
+		return -1;
+	}
+	std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size() + 1);
+
+	std::atomic<size_t> next_request{ 0 };
+	std::atomic<size_t> n_failed{ 0 };
+	std::vector<std::vector<int64_t>> latencies(n_clients);
+	std::vector<std::thread> clients;
+
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < n_clients; ++i)
+	{
+		clients.emplace_back([&, i]()
+		{
+			int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+			{
+				if (fd >= 0)
+					close(fd);
+				return;
+			}
+
+			Connection connection(fd, fd);
+			std::string header;
+			std::string output;
+			while (next_request++ < n_requests)
+			{
+				auto request_start = std::chrono::steady_clock::now();
+				int status = -1;
+				size_t output_size = 0;
+				if (!connection.write_all(request) || !connection.read_line(header, max_header_size) ||
+					std::sscanf(header.c_str(), "%d %*d %*d %zu", &status, &output_size) != 2 ||
+					!connection.read_exact(output, output_size))
+				{
+					++n_failed;
+					break;
+				}
+
+				latencies[i].push_back(microseconds_since(request_start));
+				if (status != 0)
+					++n_failed;
+			}
+			close(fd);
+		});
+	}
+	for (auto& client : clients)
+		client.join();
+	double seconds = microseconds_since(start) / 1e6;
+
+	std::vector<int64_t> all;
+	for (const auto& client_latencies : latencies)
+		all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+	if (all.empty())
+	{
+		std::cout << "No request succeeded, is the server running on " << socket_path << "?" << std::endl;
+		return -1;
+	}
+	std::sort(all.begin(), all.end());
+
+	auto percentile = [&](double p) { return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))] / 1000.0; };
+	std::cout << all.size() << " requests from " << n_clients << " clients in " << seconds << " s, "
+		<< all.size() / seconds << " requests/s" << std::endl;
+	std::cout << "latency p50 " << percentile(0.50) << " ms, p99 " << percentile(0.99) << " ms, max " << all.back() / 1000.0 << " ms" << std::endl;
+	std::cout << n_failed << " failed" << std::endl;
+	return n_failed == 0 ? 0 : -1;
+#endif
+}
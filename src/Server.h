@@ -0,0 +1,150 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "AST.h"
+#include "Interpreter.h"
+#include "MappedFile.h"
+#include "Program.h"
+#include "Result.h"
+#include "ThreadPool.h"
+
+/*
+* A byte stream to a client or server (a socket, or stdin and stdout), reads are buffered.
+* The protocol is a header line followed by payloads whose sizes the header gives:
+*
+*   RUN <input size> <script path>\n<input>
+*   EVAL <source size> <input size>\n<source><input>
+*
+* which run the script file or the source with "input" reading the lines of <input>. Every request is answered with
+*
+*   <status> <parse microseconds> <run microseconds> <output size>\n<output>
+*
+* where the status is 0, or -1 if the program couldn't be loaded or has syntax errors.
+*/
+class Connection
+{
+public:
+	Connection(int in_fd, int out_fd);
+
+	//Returns false at the end of the stream. Stops once the line is longer than "max_size", which the caller tells by its size
+	bool read_line(std::string& line, size_t max_size);
+	bool read_exact(std::string& data, size_t size);
+	bool write_all(std::string_view data);
+
+private:
+	//Reads more data behind the unread data, returns false at the end of the stream
+	bool fill();
+
+	int m_in;
+	int m_out;
+	std::vector<char> m_buffer;
+	size_t m_pos = 0;
+	size_t m_size = 0;
+};
+
+/*
+* Runs requests (see Connection) in a long running process so that the interpreter starts once and the parsed
+* programs are kept in memory between requests. Every request runs on a fresh context (see Context) with its own
+* variables, definitions, modules and output. Script files are parsed again when their size or modification time changes.
+*/
+class Server
+{
+public:
+	struct Options
+	{
+		//At most this many requests run at once, each with its own pool of n_threads threads for the program
+		size_t n_workers = 1;
+		size_t n_threads = 1;
+		bool lazy_functions = false;
+		bool use_cache = false;
+		std::string cache_dir;
+		size_t max_depth = Interpreter::default_max_depth;
+		//The limits of every request, the deadline starts when the request starts running
+		Budget::Limits limits;
+	};
+
+	explicit Server(const Options& options);
+
+	//Answers the requests of every client connecting to the Unix domain socket at "path", never returns unless it fails
+	int serve_socket(const std::string& path);
+
+	//Answers the requests read from stdin on stdout one at a time until stdin ends
+	int serve_stdin();
+
+	//Connects to the server at "socket_path" and sends the path of "script_path" "n_requests" times from "n_clients" clients
+	static int load_test(const std::string& socket_path, const std::string& script_path, size_t n_requests, size_t n_clients);
+
+private:
+	//A parsed program with the modification time of its script file
+	struct Entry
+	{
+		std::shared_ptr<const Program> program;
+		int64_t version = 0;
+		//The key in m_recent
+		std::list<std::string>::iterator recent;
+	};
+
+	//A request whose payloads were read, "source" is only set for EVAL and "path" only for RUN
+	struct Request
+	{
+		bool eval = false;
+		std::string path;
+		std::string source;
+		std::string input;
+	};
+
+	struct Response
+	{
+		int status = 0;
+		int64_t parse_us = 0;
+		int64_t run_us = 0;
+		std::string output;
+	};
+
+	void serve_connection(Connection& connection);
+
+	//Every running request has a pool of its own, there are at most n_workers of them
+	std::unique_ptr<ThreadPool> acquire_pool();
+	void release_pool(std::unique_ptr<ThreadPool> pool);
+
+	/*
+	* Reads the payloads of the request "header", returns the output for a malformed or too large request or nullptr.
+	* The next request can only be read after a well formed one.
+	*/
+	const char* read_request(Connection& connection, const std::string& header, Request& request);
+	Result<std::shared_ptr<const Program>, std::string> load_script(const std::string& path, ThreadPool& pool);
+	Result<std::shared_ptr<const Program>, std::string> load_source(std::string source, ThreadPool& pool);
+
+	//Returns the syntax errors formatted like the output of the interpreter on failure
+	Result<std::shared_ptr<const Program>, std::string> parse(std::shared_ptr<const void> source, std::string_view text,
+		const std::string& path, ThreadPool& pool);
+
+	//Finding a program counts as using it, see m_recent
+	Entry find(const std::string& key);
+	std::shared_ptr<const Program> remember(const std::string& key, std::shared_ptr<const Program> program, int64_t version = 0);
+
+	//Runs the program on a fresh context and appends what it prints to "output"
+	void run(const std::shared_ptr<const Program>& program, std::string_view input, ThreadPool& pool, std::string& output);
+
+	Options m_options;
+
+	//Parsed programs by script path or by "eval:" and the hash of the source, only a limited number is kept
+	std::unordered_map<std::string, Entry> m_programs;
+	//The keys of m_programs, the most recently used first, the last one is dropped when a program doesn't fit
+	std::list<std::string> m_recent;
+	std::mutex m_programs_mutex;
+
+	std::vector<std::unique_ptr<ThreadPool>> m_idle_pools;
+	size_t m_n_pools = 0;
+	std::mutex m_pools_mutex;
+	std::condition_variable m_pool_released;
+};
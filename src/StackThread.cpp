@@ -0,0 +1,267 @@
+#include "StackThread.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <system_error>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+#endif
+
+//Checks happen once per call, the statements and expressions between two calls have to fit in what is left
+static constexpr size_t stack_reserve = 256 * 1024;
+
+static const char* stack_limit(const char* low, size_t size)
+{
+	return low + std::min<size_t>(stack_reserve, size / 4);
+}
+
+static const char* find_stack_limit();
+
+//Lowest address the calling thread may use before it is considered out of stack, nullptr if unknown
+static thread_local const char* t_stack_limit = find_stack_limit();
+
+#ifdef _WIN32
+
+static DWORD WINAPI thread_main(void* arg)
+{
+	std::unique_ptr<std::function<void()>> fn(static_cast<std::function<void()>*>(arg));
+	(*fn)();
+	return 0;
+}
+
+StackThread::StackThread(size_t stack_size, std::function<void()> fn)
+{
+	auto* arg = new std::function<void()>(std::move(fn));
+	m_handle = CreateThread(nullptr, stack_size, thread_main, arg, STACK_SIZE_PARAM_IS_A_RESERVATION, nullptr);
+	if (!m_handle && stack_size != 0)
+		m_handle = CreateThread(nullptr, 0, thread_main, arg, 0, nullptr);
+	if (!m_handle)
+	{
+		delete arg;
+		throw std::system_error(static_cast<int>(GetLastError()), std::system_category(), "CreateThread");
+	}
+}
+
+StackThread::~StackThread()
+{
+	if (m_handle)
+		join();
+}
+
+void StackThread::join()
+{
+	WaitForSingleObject(m_handle, INFINITE);
+	CloseHandle(m_handle);
+	m_handle = nullptr;
+}
+
+void StackThread::detach()
+{
+	CloseHandle(m_handle);
+	m_handle = nullptr;
+}
+
+struct StackCall
+{
+	const std::function<void()>* fn;
+	void* caller;
+	std::exception_ptr error;
+};
+
+static void WINAPI fiber_main(void* arg)
+{
+	auto* call = static_cast<StackCall*>(arg);
+	t_stack_limit = find_stack_limit();
+	try
+	{
+		(*call->fn)();
+	}
+	catch (...)
+	{
+		call->error = std::current_exception();
+	}
+	SwitchToFiber(call->caller);
+}
+
+void run_on_stack(size_t stack_size, const std::function<void()>& fn)
+{
+	//A thread has to be a fiber to switch to another one
+	bool was_fiber = IsThreadAFiber();
+	void* caller = was_fiber ? GetCurrentFiber() : ConvertThreadToFiber(nullptr);
+	StackCall call{ &fn, caller, nullptr };
+	void* fiber = caller ? CreateFiberEx(0, stack_size, 0, fiber_main, &call) : nullptr;
+	if (!fiber)
+	{
+		if (caller && !was_fiber)
+			ConvertFiberToThread();
+		fn();
+		return;
+	}
+
+	const char* caller_limit = t_stack_limit;
+	SwitchToFiber(fiber);
+	t_stack_limit = caller_limit;
+	DeleteFiber(fiber);
+	if (!was_fiber)
+		ConvertFiberToThread();
+
+	if (call.error)
+		std::rethrow_exception(call.error);
+}
+
+static const char* find_stack_limit()
+{
+	ULONG_PTR low = 0;
+	ULONG_PTR high = 0;
+	GetCurrentThreadStackLimits(&low, &high);
+	return stack_limit(reinterpret_cast<const char*>(low), high - low);
+}
+
+#else
+
+static void* thread_main(void* arg)
+{
+	std::unique_ptr<std::function<void()>> fn(static_cast<std::function<void()>*>(arg));
+	(*fn)();
+	return nullptr;
+}
+
+StackThread::StackThread(size_t stack_size, std::function<void()> fn)
+{
+	auto* arg = new std::function<void()>(std::move(fn));
+
+	//Falls back to the default size if a stack this large can't be reserved
+	int error = EINVAL;
+	pthread_attr_t attr;
+	if (stack_size != 0 && pthread_attr_init(&attr) == 0)
+	{
+		if (pthread_attr_setstacksize(&attr, stack_size) == 0)
+			error = pthread_create(&m_thread, &attr, thread_main, arg);
+		pthread_attr_destroy(&attr);
+	}
+	if (error != 0)
+		error = pthread_create(&m_thread, nullptr, thread_main, arg);
+	if (error != 0)
+	{
+		delete arg;
+		throw std::system_error(error, std::system_category(), "pthread_create");
+	}
+	m_joinable = true;
+}
+
+StackThread::~StackThread()
+{
+	if (m_joinable)
+		join();
+}
+
+void StackThread::join()
+{
+	pthread_join(m_thread, nullptr);
+	m_joinable = false;
+}
+
+void StackThread::detach()
+{
+	pthread_detach(m_thread);
+	m_joinable = false;
+}
+
+struct StackCall
+{
+	const std::function<void()>* fn;
+	std::exception_ptr error;
+};
+
+//makecontext can only pass int arguments so the call is handed over through the thread
+static thread_local StackCall* t_stack_call = nullptr;
+
+static void stack_main()
+{
+	StackCall* call = t_stack_call;
+	try
+	{
+		(*call->fn)();
+	}
+	catch (...)
+	{
+		call->error = std::current_exception();
+	}
+}
+
+void run_on_stack(size_t stack_size, const std::function<void()>& fn)
+{
+	//The pages are only committed when they are touched, the lowest page is a guard
+	size_t page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	stack_size = (stack_size + page_size - 1) / page_size * page_size;
+	void* mapping = stack_size ? mmap(nullptr, stack_size + page_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) : MAP_FAILED;
+	if (mapping == MAP_FAILED)
+	{
+		fn();
+		return;
+	}
+	mprotect(mapping, page_size, PROT_NONE);
+	char* stack = static_cast<char*>(mapping) + page_size;
+
+	ucontext_t caller;
+	ucontext_t callee;
+	getcontext(&callee);
+	callee.uc_stack.ss_sp = stack;
+	callee.uc_stack.ss_size = stack_size;
+	callee.uc_link = &caller;
+	makecontext(&callee, stack_main, 0);
+
+	StackCall call{ &fn, nullptr };
+	StackCall* outer_call = t_stack_call;
+	const char* caller_limit = t_stack_limit;
+	t_stack_call = &call;
+	t_stack_limit = stack_limit(stack, stack_size);
+	swapcontext(&caller, &callee);
+	t_stack_call = outer_call;
+	t_stack_limit = caller_limit;
+
+	munmap(mapping, stack_size + page_size);
+	if (call.error)
+		std::rethrow_exception(call.error);
+}
+
+static const char* find_stack_limit()
+{
+#if defined(__linux__)
+	pthread_attr_t attr;
+	if (pthread_getattr_np(pthread_self(), &attr) != 0)
+		return nullptr;
+
+	void* low = nullptr;
+	size_t size = 0;
+	int error = pthread_attr_getstack(&attr, &low, &size);
+	pthread_attr_destroy(&attr);
+	if (error != 0)
+		return nullptr;
+	return stack_limit(static_cast<const char*>(low), size);
+#elif defined(__APPLE__)
+	char* high = static_cast<char*>(pthread_get_stackaddr_np(pthread_self()));
+	size_t size = pthread_get_stacksize_np(pthread_self());
+	return stack_limit(high - size, size);
+#else
+	return nullptr;
+#endif
+}
+
+#endif
+
+bool stack_exhausted()
+{
+	//The stack grows down on every supported platform
+	char marker;
+	return reinterpret_cast<uintptr_t>(&marker) < reinterpret_cast<uintptr_t>(t_stack_limit);
+}
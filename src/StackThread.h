@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+
+#ifdef _WIN32
+#include <cstdint>
+#else
+#include <pthread.h>
+#endif
+
+/*
+* A thread with a stack of a given size. Script calls recurse on the native stack, so the threads which run scripts
+* are started with a stack large enough for the maximum call depth. The stack is reserved up front but its memory
+* is only committed as it is used, a deep stack costs nothing until the recursion actually gets there.
+*/
+class StackThread
+{
+public:
+	//A stack size of 0 uses the default of the platform
+	StackThread(size_t stack_size, std::function<void()> fn);
+	//Joins the thread unless it was detached
+	~StackThread();
+
+	StackThread(const StackThread&) = delete;
+	StackThread& operator=(const StackThread&) = delete;
+
+	void join();
+	void detach();
+
+private:
+#ifdef _WIN32
+	void* m_handle = nullptr;
+#else
+	pthread_t m_thread;
+	bool m_joinable = false;
+#endif
+};
+
+/*
+* Runs fn on a stack of "stack_size" bytes on the calling thread and returns when it returns, exceptions are passed
+* on. Unlike a StackThread this doesn't start a thread, so a single threaded process stays single threaded.
+*/
+void run_on_stack(size_t stack_size, const std::function<void()>& fn);
+
+//True when the calling thread is about to run out of stack, false if the bounds of its stack are unknown
+bool stack_exhausted();
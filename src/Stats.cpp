@@ -0,0 +1,103 @@
+#include "Stats.h"
+
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+static const char* const node_names[] = {
+	"Literal", "Identifier", "Unary", "If", "While", "Print", "Cast", "Input", "Binary", "Block", "Let", "Assignment",
+	"Function", "Call", "Return", "Struct", "Field", "FieldAssignment", "Spawn", "Await", "Yield", "Import"
+};
+static_assert(std::size(node_names) == static_cast<size_t>(Stats::Node::Count));
+
+static const char* const allocation_names[] = {
+	"Int", "Float", "Char", "String", "Reference", "Void", "Map", "Record", "Future", "Generator"
+};
+static_assert(std::size(allocation_names) == static_cast<size_t>(Stats::Allocation::Count));
+
+const char* Stats::name(Node node)
+{
+	return node_names[static_cast<size_t>(node)];
+}
+
+template <size_t N>
+static std::vector<std::pair<const char*, uint64_t>> by_count(const std::array<std::atomic<uint64_t>, N>& counters, const char* const* names)
+{
+	std::vector<std::pair<const char*, uint64_t>> sorted;
+	for (size_t i = 0; i < N; ++i)
+		sorted.emplace_back(names[i], counters[i].load(std::memory_order_relaxed));
+	std::stable_sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+	return sorted;
+}
+
+static double to_ms(uint64_t ns)
+{
+	return ns / 1e6;
+}
+
+void Stats::write_text(std::ostream& out, const Phases& phases)
+{
+	out << "stats: parse " << phases.parse_ms << " ms";
+	if (enabled)
+		out << " (" << to_ms(s_lex_ns.load(std::memory_order_relaxed)) << " ms in the lexer)";
+	out << ", exec " << phases.exec_ms << " ms" << '\n';
+
+	if (!enabled)
+	{
+		out << "stats: counters are only available in builds with INTERPRETER_STATS defined" << '\n';
+		return;
+	}
+
+	out << "stats: " << s_calls.load(std::memory_order_relaxed) << " calls, " << s_builtin_calls.load(std::memory_order_relaxed)
+		<< " builtin calls, max depth " << s_max_depth.load(std::memory_order_relaxed) << '\n';
+	out << "stats: " << s_scope_pushes.load(std::memory_order_relaxed) << " scope pushes, "
+		<< s_scope_pops.load(std::memory_order_relaxed) << " scope pops" << '\n';
+	out << "stats: " << s_concatenated_bytes.load(std::memory_order_relaxed) << " string bytes concatenated" << '\n';
+
+	//Only the kinds which occurred, the most frequent first
+	out << "stats: nodes";
+	for (const auto& [name, count] : by_count(s_nodes, node_names))
+	{
+		if (count != 0)
+			out << ' ' << name << ' ' << count;
+	}
+	out << '\n';
+
+	out << "stats: allocations";
+	for (const auto& [name, count] : by_count(s_allocations, allocation_names))
+	{
+		if (count != 0)
+			out << ' ' << name << ' ' << count;
+	}
+	out << '\n';
+}
+
+void Stats::write_json(std::ostream& out, const Phases& phases)
+{
+	out << "{\"enabled\": " << (enabled ? "true" : "false")
+		<< ", \"phases_ms\": {\"parse\": " << phases.parse_ms << ", \"exec\": " << phases.exec_ms;
+	if (enabled)
+		out << ", \"lex\": " << to_ms(s_lex_ns.load(std::memory_order_relaxed));
+	out << "}";
+
+	if (enabled)
+	{
+		out << ", \"calls\": " << s_calls.load(std::memory_order_relaxed)
+			<< ", \"builtin_calls\": " << s_builtin_calls.load(std::memory_order_relaxed)
+			<< ", \"max_depth\": " << s_max_depth.load(std::memory_order_relaxed)
+			<< ", \"scope_pushes\": " << s_scope_pushes.load(std::memory_order_relaxed)
+			<< ", \"scope_pops\": " << s_scope_pops.load(std::memory_order_relaxed)
+			<< ", \"concatenated_bytes\": " << s_concatenated_bytes.load(std::memory_order_relaxed);
+
+		out << ", \"nodes\": {";
+		for (size_t i = 0; i < s_nodes.size(); ++i)
+			out << (i ? ", " : "") << '"' << node_names[i] << "\": " << s_nodes[i].load(std::memory_order_relaxed);
+		out << "}, \"allocations\": {";
+		for (size_t i = 0; i < s_allocations.size(); ++i)
+			out << (i ? ", " : "") << '"' << allocation_names[i] << "\": " << s_allocations[i].load(std::memory_order_relaxed);
+		out << "}";
+	}
+	out << "}" << '\n';
+}
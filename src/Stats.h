@@ -0,0 +1,129 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <ostream>
+#include <type_traits>
+
+/*
+* Counters of what the interpreters of the process did, printed by --stats. They are only compiled in when
+* INTERPRETER_STATS is defined, otherwise the STATS_ macros below expand to nothing and counting costs nothing.
+* The counters are shared by all threads and never reset, the timings of the phases are measured by the caller
+* whether the counters are compiled in or not.
+*/
+class Stats
+{
+public:
+#ifdef INTERPRETER_STATS
+	static constexpr bool enabled = true;
+#else
+	static constexpr bool enabled = false;
+#endif
+
+	enum class Node : uint8_t
+	{
+		Literal, Identifier, Unary, If, While, Print, Cast, Input, Binary, Block, Let, Assignment, Function, Call,
+		Return, Struct, Field, FieldAssignment, Spawn, Await, Yield, Import,
+		Count
+	};
+
+	enum class Allocation : uint8_t
+	{
+		Int, Float, Char, String, Reference, Void, Map, Record, Future, Generator,
+		Count
+	};
+
+	//Wall time of loading the program (lexing and parsing it or reading its cache) and of running it
+	struct Phases
+	{
+		double parse_ms = 0;
+		double exec_ms = 0;
+	};
+
+	static const char* name(Node node);
+
+	static inline void count(Node node) { add(s_nodes[static_cast<size_t>(node)], 1); }
+	static inline void count(Allocation allocation) { add(s_allocations[static_cast<size_t>(allocation)], 1); }
+
+	template <typename T>
+	static constexpr Allocation number_allocation()
+	{
+		if constexpr (std::is_same_v<T, int>)
+			return Allocation::Int;
+		else if constexpr (std::is_same_v<T, float>)
+			return Allocation::Float;
+		else
+			return Allocation::Char;
+	}
+
+	static inline void count_scope_push() { add(s_scope_pushes, 1); }
+	static inline void count_scope_pop() { add(s_scope_pops, 1); }
+	static inline void count_builtin_call() { add(s_builtin_calls, 1); }
+	static inline void count_concatenation(size_t n_bytes) { add(s_concatenated_bytes, n_bytes); }
+
+	//A call of a script function, "depth" counts the calls it is nested in including itself
+	static inline void count_call(size_t depth)
+	{
+		add(s_calls, 1);
+		uint64_t max_depth = s_max_depth.load(std::memory_order_relaxed);
+		while (depth > max_depth && !s_max_depth.compare_exchange_weak(max_depth, depth, std::memory_order_relaxed))
+			;
+	}
+
+	//Adds the time until it is destroyed to the time spent in the lexer
+	class LexTimer
+	{
+	public:
+		inline LexTimer() : m_start(std::chrono::steady_clock::now()) {}
+		inline ~LexTimer()
+		{
+			auto elapsed = std::chrono::steady_clock::now() - m_start;
+			add(s_lex_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+		}
+
+	private:
+		std::chrono::steady_clock::time_point m_start;
+	};
+
+	//One "stats:" line per group of counters
+	static void write_text(std::ostream& out, const Phases& phases);
+	static void write_json(std::ostream& out, const Phases& phases);
+
+private:
+	static inline void add(std::atomic<uint64_t>& counter, uint64_t n) { counter.fetch_add(n, std::memory_order_relaxed); }
+
+	static inline std::array<std::atomic<uint64_t>, static_cast<size_t>(Node::Count)> s_nodes{};
+	static inline std::array<std::atomic<uint64_t>, static_cast<size_t>(Allocation::Count)> s_allocations{};
+	static inline std::atomic<uint64_t> s_scope_pushes{ 0 };
+	static inline std::atomic<uint64_t> s_scope_pops{ 0 };
+	static inline std::atomic<uint64_t> s_calls{ 0 };
+	static inline std::atomic<uint64_t> s_builtin_calls{ 0 };
+	static inline std::atomic<uint64_t> s_max_depth{ 0 };
+	static inline std::atomic<uint64_t> s_concatenated_bytes{ 0 };
+	static inline std::atomic<uint64_t> s_lex_ns{ 0 };
+};
+
+#ifdef INTERPRETER_STATS
+#define STATS_NODE(type) Stats::count(Stats::Node::type)
+#define STATS_ALLOCATION(type) Stats::count(Stats::Allocation::type)
+#define STATS_NUMBER_ALLOCATION(T) Stats::count(Stats::number_allocation<T>())
+#define STATS_SCOPE_PUSH() Stats::count_scope_push()
+#define STATS_SCOPE_POP() Stats::count_scope_pop()
+#define STATS_CALL(depth) Stats::count_call(depth)
+#define STATS_BUILTIN_CALL() Stats::count_builtin_call()
+#define STATS_CONCATENATION(n_bytes) Stats::count_concatenation(n_bytes)
+#define STATS_LEX_TIMER() Stats::LexTimer stats_lex_timer
+#else
+#define STATS_NODE(type) ((void)0)
+#define STATS_ALLOCATION(type) ((void)0)
+#define STATS_NUMBER_ALLOCATION(T) ((void)0)
+#define STATS_SCOPE_PUSH() ((void)0)
+#define STATS_SCOPE_POP() ((void)0)
+#define STATS_CALL(depth) ((void)0)
+#define STATS_BUILTIN_CALL() ((void)0)
+#define STATS_CONCATENATION(n_bytes) ((void)0)
+#define STATS_LEX_TIMER() ((void)0)
+#endif
@@ -0,0 +1,139 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+//Lets a thread find its own queue, threads which are not workers of the pool use the shared queue
+static thread_local const ThreadPool* t_pool = nullptr;
+static thread_local size_t t_queue_index = 0;
+
+ThreadPool::ThreadPool(size_t n_threads, size_t stack_size)
+{
+	if (n_threads == 0)
+		n_threads = 1;
+
+	for (size_t i = 0; i < n_threads; ++i)
+		m_queues.push_back(std::make_unique<Queue>());
+
+	for (size_t i = 0; i + 1 < n_threads; ++i)
+		m_workers.push_back(std::make_unique<StackThread>(stack_size, [this, i]() { worker_loop(i); }));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+
+	for (auto& worker : m_workers)
+		worker->join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	size_t queue_index = t_pool == this ? t_queue_index : m_queues.size() - 1;
+	++m_n_unfinished;
+	{
+		std::lock_guard<std::mutex> lock(m_queues[queue_index]->mutex);
+		m_queues[queue_index]->tasks.push_back(std::move(task));
+	}
+	++m_n_pending;
+
+	//Taking the lock makes sure a worker can't miss the wakeup between checking for work and going to sleep
+	{
+		std::lock_guard<std::mutex> lock(m_sleep_mutex);
+	}
+	m_wake.notify_one();
+}
+
+bool ThreadPool::try_run_one()
+{
+	std::function<void()> task;
+	if (!pop_task(t_pool == this ? t_queue_index : m_queues.size() - 1, task))
+		return false;
+
+	task();
+	--m_n_unfinished;
+	return true;
+}
+
+void ThreadPool::parallel_for(size_t begin, size_t end, const std::function<void(size_t, size_t)>& fn)
+{
+	if (begin >= end)
+		return;
+
+	size_t n = end - begin;
+	size_t n_chunks = std::min(n, get_thread_count() * 4);
+	std::atomic<size_t> n_remaining(n_chunks);
+
+	for (size_t chunk = 0; chunk < n_chunks; ++chunk)
+	{
+		size_t chunk_begin = begin + n * chunk / n_chunks;
+		size_t chunk_end = begin + n * (chunk + 1) / n_chunks;
+		submit([&fn, &n_remaining, chunk_begin, chunk_end]()
+		{
+			fn(chunk_begin, chunk_end);
+			--n_remaining;
+		});
+	}
+
+	//Help out instead of blocking, this also makes nested parallel_for calls from tasks safe
+	while (n_remaining > 0)
+	{
+		if (!try_run_one())
+			std::this_thread::yield();
+	}
+}
+
+//Pops from the back of our own queue and otherwise steals from the front of the others
+bool ThreadPool::pop_task(size_t queue_index, std::function<void()>& task)
+{
+	if (m_n_pending == 0)
+		return false;
+
+	for (size_t i = 0; i < m_queues.size(); ++i)
+	{
+		Queue& queue = *m_queues[(queue_index + i) % m_queues.size()];
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.tasks.empty())
+			continue;
+
+		if (i == 0)
+		{
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		else
+		{
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		--m_n_pending;
+		return true;
+	}
+
+	return false;
+}
+
+void ThreadPool::worker_loop(size_t index)
+{
+	t_pool = this;
+	t_queue_index = index;
+
+	while (true)
+	{
+		std::function<void()> task;
+		if (pop_task(index, task))
+		{
+			task();
+			--m_n_unfinished;
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(m_sleep_mutex);
+		m_wake.wait(lock, [this]() { return m_stop || m_n_pending > 0; });
+		if (m_stop && m_n_pending == 0)
+			return;
+	}
+}
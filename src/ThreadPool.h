@@ -0,0 +1,70 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+
+#include "StackThread.h"
+
+/*
+* Work stealing thread pool.
+* Every worker owns a task deque, it pops its own tasks from the back and steals from the
+* front of the other deques when it runs out of work. Threads which have to wait for tasks
+* (such as the caller of parallel_for) run pending tasks instead of blocking so the pool
+* can be used recursively without deadlocking.
+*/
+class ThreadPool
+{
+public:
+	/*
+	* The calling thread counts as one of the threads so n_threads - 1 workers are started.
+	* Workers get stacks of "stack_size" bytes, 0 for the default (see StackThread).
+	*/
+	explicit ThreadPool(size_t n_threads, size_t stack_size = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	inline size_t get_thread_count() const { return m_workers.size() + 1; }
+
+	void submit(std::function<void()> task);
+
+	//Runs one pending task on the calling thread, returns false if there was nothing to run
+	bool try_run_one();
+
+	//True when no task is queued or running
+	inline bool is_idle() const { return m_n_unfinished == 0; }
+
+	/*
+	* Calls fn(chunk_begin, chunk_end) for consecutive chunks covering [begin, end) and blocks
+	* until all chunks are done. The range is split into a few chunks per thread so that
+	* uneven work can be balanced by stealing.
+	*/
+	void parallel_for(size_t begin, size_t end, const std::function<void(size_t, size_t)>& fn);
+
+private:
+	struct Queue
+	{
+		std::mutex mutex;
+		std::deque<std::function<void()>> tasks;
+	};
+
+	bool pop_task(size_t queue_index, std::function<void()>& task);
+	void worker_loop(size_t index);
+
+	//One queue per worker plus one shared by all non-worker threads
+	std::vector<std::unique_ptr<Queue>> m_queues;
+	std::vector<std::unique_ptr<StackThread>> m_workers;
+
+	std::mutex m_sleep_mutex;
+	std::condition_variable m_wake;
+	std::atomic<size_t> m_n_pending{ 0 };
+	std::atomic<size_t> m_n_unfinished{ 0 };
+	bool m_stop = false;
+};
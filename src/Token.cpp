@@ -1,55 +1,36 @@
 #include "Token.h"
 #include <iostream>
 
-Token::Token(TokenType t, std::unordered_map<std::string, std::string> m, size_t position)
+Token::Token(TokenType t, std::string_view text, size_t position, LiteralType literal_type)
 	: type(t)
-	, m_meta(m)
+	, m_text(text)
+	, m_literal_type(literal_type)
 	, m_position(position)
 {}
 
 void Token::print() const
 {
-	if (m_meta.empty())
+	if (m_text.empty())
 	{
 		std::cout << (int)type;
 	}
 	else
 	{
-		std::cout << (int)type << " [";
-		for (const auto& entry : m_meta)
-		{
-			std::cout << "'" << entry.first << "'" << ":" << " '" << entry.second << "', ";
-		}
-		std::cout << "]";
+		std::cout << (int)type << " ['" << m_text << "']";
 	}
 }
 
-const std::string& Token::get_string(const std::string& key) const
+int Token::get_int() const
 {
-	return m_meta.at(key);
+	return std::stoi(std::string(m_text));
 }
 
-int Token::get_int(const std::string& key) const
+float Token::get_float() const
 {
-	return std::stoi(m_meta.at(key).c_str());
+	return std::stof(std::string(m_text));
 }
 
-float Token::get_float(const std::string& key) const
+char Token::get_char() const
 {
-	return std::stof(m_meta.at(key).c_str());
-}
-
-char Token::get_char(const std::string& key) const
-{
-	return m_meta.at(key).c_str()[0];
-}
-
-bool Token::is(TokenType type, const std::string& value) const
-{
-	return this->type == type && m_meta.count("value") && m_meta.at("value") == value;
-}
-
-bool Token::is_not(TokenType type, const std::string& value) const
-{
-	return !is(type, value);
+	return m_text[0];
 }
@@ -1,7 +1,7 @@
 #pragma once
 
 #include <string>
-#include <unordered_map>
+#include <string_view>
 
 enum class TokenType
 {
@@ -14,26 +14,41 @@ enum class TokenType
 	TYPE
 };
 
+enum class LiteralType
+{
+	NONE,
+	INTEGER,
+	FLOAT,
+	CHAR,
+	STRING
+};
+
+/*
+* Tokens don't own their text, it points into the source code which has to outlive them.
+* The text is the name of identifiers, the contents of literals (without quotes) and the symbol or word otherwise.
+*/
 struct Token
 {
 	const TokenType type;
 
-	Token(TokenType t, std::unordered_map<std::string, std::string> m, size_t position);
+	Token(TokenType t, std::string_view text, size_t position, LiteralType literal_type = LiteralType::NONE);
 
 	inline size_t get_position() const { return m_position; }
 
 	void print() const;
 
-	const std::string& get_string(const std::string& key) const;
-	int get_int(const std::string& key) const;
-	float get_float(const std::string& key) const;
-	char get_char(const std::string& key) const;
+	inline std::string_view get_text() const { return m_text; }
+	inline LiteralType get_literal_type() const { return m_literal_type; }
+	int get_int() const;
+	float get_float() const;
+	char get_char() const;
 
-	bool is(TokenType type, const std::string& value) const;
+	inline bool is(TokenType type, std::string_view text) const { return this->type == type && m_text == text; }
 	//This only exists beacause it's clearer than saying !tok.is(...)
-	bool is_not(TokenType type, const std::string& value) const;
+	inline bool is_not(TokenType type, std::string_view text) const { return !is(type, text); }
 
 private:
-	const std::unordered_map<std::string, std::string> m_meta;
+	const std::string_view m_text;
+	const LiteralType m_literal_type;
 	const size_t m_position;
 };
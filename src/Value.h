@@ -2,7 +2,16 @@
 
 #include <memory>
 #include <string>
+#include <string_view>
+#include <cstdint>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include "Result.h"
+#include "HashMap.h"
+#include "MemoryAccount.h"
+#include "Stats.h"
 
 template <typename T>
 class NumberValue;
@@ -18,6 +27,10 @@ public:
 	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class StringValue&) = 0;
 	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class ReferenceValue&) = 0;
 	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class VoidValue&) = 0;
+	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class MapValue&) = 0;
+	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class RecordValue&) = 0;
+	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class FutureValue&) = 0;
+	virtual Result<std::shared_ptr<class Value>, const char*> visit(const class GeneratorValue&) = 0;
 };
 
 class Value
@@ -29,11 +42,11 @@ public:
 };
 
 template <typename T>
-class NumberValue : public Value
+class NumberValue final : public Value
 {
 public:
-	NumberValue(T value) : value(value) {}
-	NumberValue() { value = 0; }
+	NumberValue(T value) : value(value) { STATS_NUMBER_ALLOCATION(T); }
+	NumberValue() { value = 0; STATS_NUMBER_ALLOCATION(T); }
 	operator T() const { return value; }
 	inline virtual bool is_truthy() const override { return value != 0; }
 	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
@@ -46,20 +59,43 @@ public:
 class StringValue : public Value
 {
 public:
-	inline StringValue(const std::string& text)
-		: text(text) {}
-	std::string text;
+	inline StringValue(std::string text)
+		: m_storage(std::move(text))
+		, m_memory(sizeof(StringValue) + m_storage.size())
+		, text(m_storage) { STATS_ALLOCATION(String); }
+
+	//References memory kept alive by "owner" (such as a mapped file) instead of copying it
+	inline StringValue(std::string_view text, std::shared_ptr<const void> owner)
+		: m_owner(std::move(owner))
+		, m_memory(sizeof(StringValue))
+		, text(text) { STATS_ALLOCATION(String); }
+
+	//The text points into the value itself so it can't be copied
+	StringValue(const StringValue&) = delete;
+	StringValue& operator=(const StringValue&) = delete;
+
 	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
 	{
 		return visitor.visit(*this);
 	}
+
+private:
+	std::string m_storage;
+	std::shared_ptr<const void> m_owner;
+	//Only owned text is charged, the text of a mapped file is not on the heap
+	MemoryCharge m_memory;
+
+public:
+	const std::string_view text;
 };
 
-class ReferenceValue : public Value
+class ReferenceValue final : public Value
 {
 public:
-	inline ReferenceValue(std::shared_ptr<Value>* variable)
-		: m_value_ptr(variable) {}
+	//If the referenced variable lives inside another value (such as a record field) "owner" keeps it alive
+	inline ReferenceValue(std::shared_ptr<Value>* variable, std::shared_ptr<Value> owner = nullptr)
+		: m_value_ptr(variable)
+		, m_owner(std::move(owner)) { STATS_ALLOCATION(Reference); }
 	inline const std::shared_ptr<Value>& get_variable_value() const { return *m_value_ptr; }
 	inline void set_variable_value(const std::shared_ptr<Value>& value) const { *m_value_ptr = value; }
 	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
@@ -68,13 +104,234 @@ public:
 	}
 private:
 	std::shared_ptr<Value>* m_value_ptr;
+	std::shared_ptr<Value> m_owner;
 };
 
 class VoidValue : public Value
 {
 public:
+	inline VoidValue() { STATS_ALLOCATION(Void); }
+
+	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
+	{
+		return visitor.visit(*this);
+	}
+};
+
+
+struct MapKey
+{
+	enum class Kind : uint8_t
+	{
+		INT,
+		CHAR,
+		STRING
+	};
+
+	Kind kind = Kind::INT;
+	int number = 0;
+	std::string text;
+
+	inline bool operator==(const MapKey& other) const
+	{
+		return kind == other.kind && number == other.number && text == other.text;
+	}
+};
+
+struct MapKeyHash
+{
+	inline size_t operator()(const MapKey& key) const
+	{
+		uint64_t hash = key.kind == MapKey::Kind::STRING ? std::hash<std::string>{}(key.text) : static_cast<uint32_t>(key.number);
+		hash ^= static_cast<uint64_t>(key.kind) << 56;
+
+		//Finalizer from splitmix64, the map masks off the low bits so they have to be well mixed
+		hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+		return static_cast<size_t>(hash ^ (hash >> 31));
+	}
+};
+
+class MapValue : public Value
+{
+public:
+	inline MapValue() : m_memory(sizeof(MapValue)) { STATS_ALLOCATION(Map); }
+
+	//Only ints, chars and strings can be used as keys
+	static bool to_key(const Value& value, MapKey& key)
+	{
+		if (const auto* number = dynamic_cast<const NumberValue<int>*>(&value))
+		{
+			key = { MapKey::Kind::INT, number->value, {} };
+			return true;
+		}
+		if (const auto* character = dynamic_cast<const NumberValue<char>*>(&value))
+		{
+			key = { MapKey::Kind::CHAR, character->value, {} };
+			return true;
+		}
+		if (const auto* string = dynamic_cast<const StringValue*>(&value))
+		{
+			key = { MapKey::Kind::STRING, 0, std::string(string->text) };
+			return true;
+		}
+		return false;
+	}
+
+	static std::shared_ptr<Value> from_key(const MapKey& key)
+	{
+		switch (key.kind)
+		{
+		case MapKey::Kind::INT:
+			return std::make_shared<NumberValue<int>>(key.number);
+		case MapKey::Kind::CHAR:
+			return std::make_shared<NumberValue<char>>(static_cast<char>(key.number));
+		default:
+			return std::make_shared<StringValue>(key.text);
+		}
+	}
+
+	//Changes the entries and the memory charged for them, returns true if the key was inserted
+	bool insert_or_assign(MapKey key, std::shared_ptr<Value> value)
+	{
+		size_t key_bytes = key.text.size();
+		if (!entries.insert_or_assign(std::move(key), std::move(value)))
+			return false;
+		m_key_bytes += key_bytes;
+		m_memory.resize(sizeof(MapValue) + entries.memory_usage() + m_key_bytes);
+		return true;
+	}
+
+	bool erase(const MapKey& key)
+	{
+		if (!entries.erase(key))
+			return false;
+		m_key_bytes -= key.text.size();
+		m_memory.resize(sizeof(MapValue) + entries.memory_usage() + m_key_bytes);
+		return true;
+	}
+
+	inline virtual bool is_truthy() const override { return entries.size() != 0; }
+	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
+	{
+		return visitor.visit(*this);
+	}
+
+	//Changed through insert_or_assign and erase, which keep the charged memory up to date
+	HashMap<MapKey, std::shared_ptr<Value>, MapKeyHash> entries;
+
+private:
+	size_t m_key_bytes = 0;
+	MemoryCharge m_memory;
+};
+
+/*
+* The shape of a struct, created once by the parser for every struct declaration.
+* Records only store a pointer to their layout and an array of field values.
+*/
+class StructLayout
+{
+public:
+	static constexpr size_t npos = static_cast<size_t>(-1);
+
+	StructLayout(const std::string& name, const std::vector<std::string>& fields)
+		: m_name(name)
+		, m_fields(fields)
+	{}
+
+	inline const std::string& get_name() const { return m_name; }
+	inline const std::vector<std::string>& get_fields() const { return m_fields; }
+
+	size_t index_of(const std::string& field) const
+	{
+		for (size_t i = 0; i < m_fields.size(); ++i)
+		{
+			if (m_fields[i] == field)
+				return i;
+		}
+		return npos;
+	}
+
+private:
+	const std::string m_name;
+	const std::vector<std::string> m_fields;
+};
+
+class RecordValue : public Value
+{
+public:
+	RecordValue(std::shared_ptr<const StructLayout> layout, std::vector<std::shared_ptr<Value>> slots)
+		: layout(std::move(layout))
+		, slots(std::move(slots))
+		, m_memory(sizeof(RecordValue) + this->slots.size() * sizeof(std::shared_ptr<Value>))
+	{
+		STATS_ALLOCATION(Record);
+	}
+
+	inline virtual bool is_truthy() const override { return true; }
 	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
 	{
 		return visitor.visit(*this);
 	}
+
+	const std::shared_ptr<const StructLayout> layout;
+	std::vector<std::shared_ptr<Value>> slots;
+
+private:
+	MemoryCharge m_memory;
 };
+
+//The result of a spawned function call, completed by the thread which runs the call
+class FutureValue : public Value
+{
+public:
+	inline FutureValue() { STATS_ALLOCATION(Future); }
+
+	void complete(const Result<std::shared_ptr<Value>, const char*>& result)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			if (result.is_error())
+				m_error = result.get_error();
+			else
+				m_value = *result;
+			m_ready = true;
+		}
+		m_ready_cv.notify_all();
+	}
+
+	bool is_ready() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_ready;
+	}
+
+	//Returns early if the future is completed before the timeout
+	template <typename Duration>
+	void wait_for(Duration timeout) const
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_ready_cv.wait_for(lock, timeout, [this]() { return m_ready; });
+	}
+
+	//Only valid once the future is ready
+	Result<std::shared_ptr<Value>, const char*> get() const
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_error)
+			return m_error;
+		return m_value;
+	}
+
+	inline virtual Result<std::shared_ptr<Value>, const char*> accept(ValueVisitor& visitor) const override
+	{
+		return visitor.visit(*this);
+	}
+
+private:
+	mutable std::mutex m_mutex;
+	mutable std::condition_variable m_ready_cv;
+	bool m_ready = false;
+	std::shared_ptr<Value> m_value;
+	const char* m_error = nullptr;
+};
\ No newline at end of file
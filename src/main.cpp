@@ -3,71 +3,348 @@
 #include <vector>
 #include <string>
 #include <array>
+#include <chrono>
 #include <fstream>
-#include <sstream>
+#include <thread>
 
 #include "Lexer.h"
 #include "AST.h"
 #include "Interpreter.h"
+#include "MappedFile.h"
 
 #include "Parser.h"
+#include "ModuleLoader.h"
+#include "Program.h"
+#include "Context.h"
+#include "InstrumentedInterpreter.h"
+#include "Server.h"
+#include "Stats.h"
 
-int main(int argc, char* argv[])
+static void print_gc_stats(const Heap::Stats& stats)
 {
-	Lexer lexer;
-	Parser parser;
-	Interpreter interpreter;
+	std::cerr << "gc: " << stats.n_collections << " collections, "
+		<< stats.total_pause_ms << " ms total pause, " << stats.max_pause_ms << " ms max pause" << std::endl;
+	std::cerr << "gc: " << stats.n_tracked << " containers tracked, " << stats.n_freed << " freed from cycles" << std::endl;
+}
 
-	std::string input_code;
+static double elapsed_ms(std::chrono::steady_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
-	if (argc >= 2)
-	{
-		std::ifstream input_file(argv[1]);
+//The text goes to stderr, the JSON to its file if one was given
+static void write_stats(const Stats::Phases& phases, bool text, std::ofstream& json_file)
+{
+	if (text)
+		Stats::write_text(std::cerr, phases);
+	if (json_file.is_open())
+		Stats::write_json(json_file, phases);
+}
 
-		if (!input_file.is_open())
+//The collapsed stacks go to the file for flamegraph.pl, the frames with the most samples to stderr
+static void write_profile(const Profiler& profiler, std::ofstream& profile_file)
+{
+	profiler.write_collapsed(profile_file);
+	profile_file.close();
+	profiler.write_top(std::cerr, 20);
+}
+
+int main(int argc, char* argv[])
+{
+	const char* source_path = nullptr;
+	size_t n_threads = std::thread::hardware_concurrency();
+	bool threads_given = false;
+	bool gc_stats = false;
+	bool line_buffered = false;
+	bool batch_input = false;
+	bool stream = false;
+	bool lazy_functions = false;
+	bool validate = false;
+	bool use_cache = false;
+	std::string cache_dir;
+	const char* serve_path = nullptr;
+	const char* load_test_path = nullptr;
+	size_t n_workers = std::thread::hardware_concurrency();
+	size_t n_requests = 1000;
+	size_t max_depth = Interpreter::default_max_depth;
+	Budget::Limits limits;
+	const char* profile_path = nullptr;
+	bool print_stats = false;
+	const char* stats_json_path = nullptr;
+	std::unique_ptr<Instrumentation> instrumentation;
+	bool bad_usage = false;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		std::string arg = argv[i];
+		if (arg == "--threads" && i + 1 < argc)
 		{
-			std::cout << "Cannot open file: " << argv[1] << std::endl;
-			return -1;
+			n_threads = std::strtoul(argv[++i], nullptr, 10);
+			threads_given = true;
 		}
-
-		std::ostringstream code_stream;
-		code_stream << input_file.rdbuf();
-		input_code = code_stream.str();
+		else if (arg == "--gc-stats")
+			gc_stats = true;
+		else if (arg == "--line-buffered")
+			line_buffered = true;
+		else if (arg == "--batch-input")
+			batch_input = true;
+		else if (arg == "--stream")
+			stream = true;
+		else if (arg == "--lazy-functions")
+			lazy_functions = true;
+		else if (arg == "--validate")
+			validate = true;
+		else if (arg == "--cache")
+			use_cache = true;
+		else if (arg == "--cache-dir" && i + 1 < argc)
+		{
+			use_cache = true;
+			cache_dir = argv[++i];
+		}
+		else if (arg == "--serve" && i + 1 < argc)
+			serve_path = argv[++i];
+		else if (arg == "--workers" && i + 1 < argc)
+			n_workers = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--load-test" && i + 1 < argc)
+			load_test_path = argv[++i];
+		else if (arg == "--requests" && i + 1 < argc)
+			n_requests = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--max-depth" && i + 1 < argc)
+			max_depth = std::strtoul(argv[++i], nullptr, 10);
+		else if (arg == "--max-steps" && i + 1 < argc)
+			limits.max_steps = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--timeout" && i + 1 < argc)
+			limits.max_milliseconds = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--max-memory" && i + 1 < argc)
+			limits.max_memory = std::strtoull(argv[++i], nullptr, 10) * 1024 * 1024;
+		else if (arg == "--profile" && i + 1 < argc)
+			profile_path = argv[++i];
+		else if (arg == "--stats")
+			print_stats = true;
+		else if (arg == "--stats-json" && i + 1 < argc)
+			stats_json_path = argv[++i];
+		else if (arg == "--instrument" && i + 1 < argc)
+		{
+			instrumentation = Instrumentation::create(argv[++i]);
+			bad_usage |= !instrumentation;
+		}
+		else if (arg.rfind("--", 0) != 0 && !source_path)
+			source_path = argv[i];
+		else
+			bad_usage = true;
 	}
-	else 
+
+	if (bad_usage || (!source_path && !serve_path))
 	{
-		std::cout << "usage: " << argv[0] << " <input file>" << std::endl;
+		std::cout << "usage: " << argv[0] << " [--threads <n>] [--gc-stats] [--line-buffered] [--batch-input] [--stream] [--lazy-functions] [--validate] [--cache] [--cache-dir <dir>] [--max-depth <n>] [--max-steps <n>] [--timeout <ms>] [--max-memory <MB>] [--profile <file>] [--stats] [--stats-json <file>] [--instrument <count | trace | time>] <input file>" << std::endl;
+		std::cout << "       " << argv[0] << " --serve <socket | -> [--workers <n>] [--threads <n>] [--lazy-functions] [--cache] [--cache-dir <dir>] [--max-depth <n>] [--max-steps <n>] [--timeout <ms>] [--max-memory <MB>]" << std::endl;
+		std::cout << "       " << argv[0] << " --load-test <socket> [--workers <n>] [--requests <n>] <input file>" << std::endl;
 		return -1;
 	}
 
-	auto lexer_res = lexer.tokenize(input_code);
-	if (lexer_res.is_error())
+	if (load_test_path)
+		return Server::load_test(load_test_path, source_path, n_requests, n_workers);
+
+	if (serve_path)
 	{
-		Error err = lexer_res.get_error();
-		std::cout << err.message << " at: "<< err.position << std::endl;
-		return -1;
+		//The requests already run in parallel, so by default each one runs on a single thread
+		Server::Options options;
+		options.n_workers = n_workers;
+		options.n_threads = threads_given ? n_threads : 1;
+		options.lazy_functions = lazy_functions;
+		options.use_cache = use_cache;
+		options.cache_dir = cache_dir;
+		options.max_depth = max_depth;
+		options.limits = limits;
+
+		Server server(options);
+		return std::string(serve_path) == "-" ? server.serve_stdin() : server.serve_socket(serve_path);
 	}
 
-	const auto& tokens = *lexer_res;
-	auto parser_res = parser.parse(tokens);
+	//Validating parses everything up front and doesn't run the program
+	if (validate)
+	{
+		stream = false;
+		lazy_functions = false;
+	}
 
-	if (parser_res.is_error())
+	//The tokens and the string literals in the tree reference the mapped source instead of copying it
+	std::shared_ptr<MappedFile> source = MappedFile::open(source_path);
+	if (!source)
 	{
-		for (const auto& err : parser_res.get_error())
-			std::cout << err.message << " at: " << err.position << std::endl;
+		std::cout << "Cannot open file: " << source_path << std::endl;
 		return -1;
 	}
 
-	const auto& tree = *parser_res;
+	//Spawned tasks still running at exit can print so the output has to outlive the pool
+	OutputBuffer output(stdout);
+	output.set_line_buffered(line_buffered);
+	InputBuffer input(batch_input);
 
-	if (tree.size() == 0) return 0;
+	std::shared_ptr<Profiler> profiler;
+	std::ofstream profile_file;
+	if (profile_path && !validate)
+	{
+		profile_file.open(profile_path);
+		if (!profile_file)
+		{
+			std::cout << "Cannot open file: " << profile_path << std::endl;
+			return -1;
+		}
+		profiler = std::make_shared<Profiler>();
+		profiler->add_source("", source->view());
+	}
 
-	for (int i = 0; i < tree.size(); ++i)
+	std::ofstream stats_json_file;
+	if (stats_json_path)
 	{
-		const auto& res = interpreter.interpret(*tree[i]);
-		if (res.is_error()) 
-			std::cout << res.get_error() << std::endl;
+		stats_json_file.open(stats_json_path);
+		if (!stats_json_file)
+		{
+			std::cout << "Cannot open file: " << stats_json_path << std::endl;
+			return -1;
+		}
 	}
+	Stats::Phases phases;
+
+	//Scripts recurse on the native stack, so they run on stacks that fit the maximum depth
+	size_t stack_size = Interpreter::stack_size(max_depth);
+	ThreadPool pool(n_threads, stack_size);
+
+	if (!stream)
+	{
+		//The cache isn't used when validating
+		Program::Options options;
+		options.lazy_functions = lazy_functions;
+		options.use_cache = use_cache && !validate;
+		options.cache_dir = cache_dir;
+
+		auto parse_start = std::chrono::steady_clock::now();
+		auto program_res = Program::parse(source, source->view(), source_path, options, pool);
+		phases.parse_ms = elapsed_ms(parse_start);
+		if (program_res.is_error())
+		{
+			for (const auto& err : program_res.get_error())
+				std::cout << err.message << " at: " << err.position << std::endl;
+			return -1;
+		}
+
+		std::shared_ptr<const Program> program = *program_res;
+		if (program->get_statements().empty() || validate)
+		{
+			write_stats(phases, print_stats, stats_json_file);
+			return 0;
+		}
+
+		Heap::Stats stats;
+		run_on_stack(stack_size, [&]()
+		{
+			Context context(program, output, input, pool, instrumentation.get());
+			context.get_interpreter().set_max_depth(max_depth);
+			context.get_interpreter().set_limits(limits);
+			context.get_interpreter().set_profiler(profiler);
+			auto exec_start = std::chrono::steady_clock::now();
+			context.run();
+			stats = context.get_interpreter().get_heap_stats();
+
+			//The samples reference the tree of the program and its modules
+			context.wait();
+			phases.exec_ms = elapsed_ms(exec_start);
+			if (profiler)
+			{
+				output.flush();
+				write_profile(*profiler, profile_file);
+			}
+		});
+		output.flush();
+
+		if (gc_stats)
+			print_gc_stats(stats);
+		if (instrumentation)
+			instrumentation->report(std::cerr);
+		write_stats(phases, print_stats, stats_json_file);
+		return 0;
+	}
+
+	bool syntax_error = false;
+	run_on_stack(stack_size, [&]()
+	{
+		//Imported modules stay loaded until the end like the tree
+		ModuleLoader modules(source_path);
+		modules.set_lazy_functions(lazy_functions);
+		modules.set_cache_dir(cache_dir);
+
+		std::vector<std::unique_ptr<ASTNode>> tree;
+		std::unique_ptr<Interpreter> interpreter = instrumentation
+			? instrumentation->create_interpreter(output, input, &pool, &modules)
+			: std::make_unique<Interpreter>(output, input, &pool, &modules);
+		interpreter->set_max_depth(max_depth);
+		interpreter->set_limits(limits);
+		interpreter->set_profiler(profiler);
+
+		/*
+		* Each statement runs as soon as it is parsed and only the tokens of the statement being parsed are kept.
+		* Statements before the first syntax error have already run when it is found. The following ones are
+		* still parsed to report their errors but don't run. The parsed statements are kept until the end since
+		* functions and spawned tasks reference them.
+		*/
+		Lexer lexer;
+		Parser parser;
+		parser.set_lazy_functions(lazy_functions);
+		lexer.start(source->view());
+		parser.start(lexer, source);
+
+		//The phases alternate, each one is timed separately
+		while (true)
+		{
+			auto parse_start = std::chrono::steady_clock::now();
+			auto parser_res = parser.parse_next();
+			phases.parse_ms += elapsed_ms(parse_start);
+			if (parser_res.is_error())
+			{
+				syntax_error = true;
+				for (const auto& err : parser_res.get_error())
+					output.write(std::string(err.message) + " at: " + std::to_string(err.position) + "\n");
+				continue;
+			}
+			if (!*parser_res)
+				break;
+
+			tree.push_back(std::move(*parser_res));
+			if (syntax_error)
+				continue;
+
+			auto exec_start = std::chrono::steady_clock::now();
+			const auto& res = interpreter->interpret(*tree.back());
+			phases.exec_ms += elapsed_ms(exec_start);
+			if (res.is_error())
+			{
+				output.write(std::string(res.get_error()) + "\n");
+
+				//An exceeded limit aborts the rest of the program
+				if (interpreter->get_abort_error())
+					break;
+			}
+		}
+
+		//Spawned tasks reference the tree and the modules, which are destroyed before the pool
+		auto wait_start = std::chrono::steady_clock::now();
+		while (interpreter->has_running_tasks())
+		{
+			if (!pool.try_run_one())
+				std::this_thread::yield();
+		}
+		phases.exec_ms += elapsed_ms(wait_start);
+		output.flush();
+
+		if (gc_stats)
+			print_gc_stats(interpreter->get_heap_stats());
+		if (instrumentation)
+			instrumentation->report(std::cerr);
+		if (profiler)
+			write_profile(*profiler, profile_file);
+		write_stats(phases, print_stats, stats_json_file);
+	});
 
-	return 0;
+	return syntax_error ? -1 : 0;
 }
\ No newline at end of file
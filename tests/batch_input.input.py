@@ -0,0 +1,14 @@
+"""Writes the input of batch_input.txt: almost 4 MB, which batch input reads in chunks of 1 MB."""
+import sys
+
+out = sys.stdout.buffer
+# Lines of varying length, the chunk boundaries fall into the middle of some of them
+out.write(b"".join(b"%d\n" % (i * 7919 % 10007) for i in range(250000)))
+out.write(b"#\n")
+# A line longer than a chunk, which has to grow to hold it
+out.write(b"x" * (1 << 21) + b"\n")
+# Lines ending in \r\n, the \r is not part of the line
+out.write(b"".join(b"%d\r\n" % (i * 31 % 997) for i in range(100000)))
+out.write(b"#\r\n")
+# The last line has no line break
+out.write(b"last")
@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+"""
+Runs every script in this directory and compares what it prints with the .expected file next to it.
+
+	python3 tests/run.py --interpreter ./Interpreter
+
+A script whose first line is "//args: <arguments>" runs with those arguments before its path, such as --threads 8.
+If there is a <script>.input.py next to it, what it writes is piped into the standard input of the script.
+Exits with 1 if the output of any script differs.
+"""
+
+import argparse
+import glob
+import os
+import subprocess
+import sys
+
+TESTS_DIR = os.path.dirname(os.path.abspath(__file__))
+ARGS_PREFIX = "//args:"
+
+
+def read_args(script):
+	with open(script) as file:
+		first_line = file.readline()
+	if not first_line.startswith(ARGS_PREFIX):
+		return []
+	return first_line[len(ARGS_PREFIX):].split()
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Runs the test scripts and compares their output")
+	parser.add_argument("--interpreter", required=True, help="the interpreter to test")
+	options = parser.parse_args()
+
+	failed = []
+	for script in sorted(glob.glob(os.path.join(TESTS_DIR, "*.txt"))):
+		name = os.path.splitext(os.path.basename(script))[0]
+		with open(os.path.join(TESTS_DIR, name + ".expected")) as file:
+			expected = file.read()
+		# The input goes through a pipe rather than a file, which batch input would map instead of reading
+		input_script = os.path.join(TESTS_DIR, name + ".input.py")
+		input_data = b""
+		if os.path.exists(input_script):
+			input_data = subprocess.run([sys.executable, input_script], stdout=subprocess.PIPE, check=True).stdout
+		result = subprocess.run([options.interpreter] + read_args(script) + [script], input=input_data,
+			capture_output=True)
+		output = result.stdout.decode(errors="replace") + result.stderr.decode(errors="replace")
+		if output != expected:
+			failed.append(name)
+			print(f"{name}: FAILED\n--- expected\n{expected}--- got\n{output}", file=sys.stderr)
+		else:
+			print(f"{name}: ok", file=sys.stderr)
+
+	if failed:
+		sys.exit(1)
+
+
+if __name__ == "__main__":
+	main()